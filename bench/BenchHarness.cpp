@@ -0,0 +1,124 @@
+#include "BenchHarness.h"
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+using namespace lbcrypto;
+using namespace std;
+
+optional<BenchPoint> makeBenchPoint(const AppConfig& config, const string& label, vector<BenchResult>& results) {
+    BenchPoint point;
+    point.results = &results;
+    try {
+        ScopedSilence quiet;
+        point.system = make_unique<ThresholdBiometricSystem>(config);
+        point.vectors = point.system->generateTestVectors(config.numVectors, config.vecDim);
+        point.probe = point.system->generateTestVectors(1, config.vecDim);
+    } catch (const exception& e) {
+        cerr << "  - skipping " << label << ": " << e.what() << endl;
+        return nullopt;
+    }
+    return point;
+}
+
+CryptoContext<DCRTPoly> makeBenchContext(uint32_t multDepth, uint32_t ringDim) {
+    CCParams<CryptoContextCKKSRNS> parameters;
+    parameters.SetMultiplicativeDepth(multDepth);
+    parameters.SetFirstModSize(60);
+    parameters.SetScalingModSize(50);
+    parameters.SetKeySwitchTechnique(HYBRID);
+    parameters.SetScalingTechnique(FLEXIBLEAUTO);
+    if (ringDim != 0) {
+        parameters.SetSecurityLevel(HEStd_NotSet);
+        parameters.SetRingDim(ringDim);
+    } else {
+        parameters.SetSecurityLevel(HEStd_128_classic);
+    }
+
+    auto cc = GenCryptoContext(parameters);
+    cc->Enable(PKE);
+    cc->Enable(KEYSWITCH);
+    cc->Enable(LEVELEDSHE);
+    cc->Enable(ADVANCEDSHE);
+    return cc;
+}
+
+vector<double> randomUnitVector(size_t dim, unsigned seed) {
+    mt19937 gen(seed);
+    normal_distribution<double> dist(0.0, 1.0);
+    vector<double> v(dim);
+    double norm = 0.0;
+    for (auto& x : v) {
+        x = dist(gen);
+        norm += x * x;
+    }
+    norm = sqrt(norm);
+    for (auto& x : v) x /= norm;
+    return v;
+}
+
+void printResult(const BenchResult& result) {
+    cout << left << setw(28) << result.name;
+    for (const auto& [key, value] : result.params) {
+        cout << " " << key << "=" << value;
+    }
+    cout << "  " << result.iterations << " iters, " << fixed << setprecision(3)
+         << result.secondsPerIteration() * 1e3 << " ms/iter";
+    for (const auto& [key, value] : result.counters) {
+        cout << ", " << key << "=" << setprecision(2) << value;
+    }
+    if (!result.failure.empty()) cout << "  FAILED: " << result.failure;
+    cout << endl;
+}
+
+namespace {
+
+string jsonString(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+void writeJson(const string& path, const vector<BenchResult>& results) {
+    ofstream ofs(path);
+    if (!ofs) throw runtime_error("Cannot write " + path);
+
+    time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    ofs << "{\n  \"context\": {\"date\": " << jsonString(timestamp)
+        << ", \"hardware_threads\": " << thread::hardware_concurrency() << "},\n  \"benchmarks\": [";
+    ofs << setprecision(9);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        ofs << (i ? "," : "") << "\n    {\"name\": " << jsonString(r.name) << ", \"params\": {";
+        size_t k = 0;
+        for (const auto& [key, value] : r.params) {
+            ofs << (k++ ? ", " : "") << jsonString(key) << ": " << jsonString(value);
+        }
+        ofs << "}, \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+            << ", \"seconds_per_iteration\": " << r.secondsPerIteration() << ", \"counters\": {";
+        k = 0;
+        for (const auto& [key, value] : r.counters) {
+            ofs << (k++ ? ", " : "") << jsonString(key) << ": " << (isfinite(value) ? value : 0.0);
+        }
+        ofs << "}";
+        if (!r.failure.empty()) ofs << ", \"failure\": " << jsonString(r.failure);
+        ofs << "}";
+    }
+    ofs << "\n  ]\n}\n";
+    if (!ofs.good()) throw runtime_error("Failed to write " + path);
+}
@@ -0,0 +1,108 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include "openfhe.h"
+#include "TemplateMatrix.h"
+#include "ThresholdBiometricSystem.h"
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    std::string filter;
+    uint32_t multDepth;
+    uint32_t ringDim;       // 0 = smallest secure ring for the depth
+    size_t vecDim;
+    size_t minIterations;
+    double minSeconds;
+
+    // parameter grid of the stage suite
+    std::vector<size_t> gridVecDims;
+    std::vector<uint32_t> gridRingDims;
+    std::vector<uint32_t> gridDepths;
+    std::vector<size_t> gridGallerySizes;
+
+    // gallery sizes of the bootstrap suite
+    std::vector<size_t> bootstrapGallerySizes;
+
+    // worker process counts, gallery size and worker binary of the sharding suite
+    std::vector<size_t> shardingWorkers;
+    size_t shardingGallerySize;
+    std::string verifyBinary;
+};
+
+struct BenchResult {
+    std::string name;
+    std::map<std::string, std::string> params;
+    size_t iterations = 0;
+    double seconds = 0.0;
+    std::map<std::string, double> counters;
+    std::string failure;    // a check on the result failed; biometric_bench exits non-zero
+
+    double secondsPerIteration() const { return iterations ? seconds / iterations : 0.0; }
+};
+
+// Runs body until both minIterations and minSeconds are reached.
+template <typename Body>
+BenchResult measure(const std::string& name, const BenchOptions& opts, Body&& body) {
+    BenchResult result;
+    result.name = name;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        body();
+        ++result.iterations;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (result.iterations < opts.minIterations || result.seconds < opts.minSeconds);
+    return result;
+}
+
+// CKKS context for stage benchmarks. A fixed ringDim disables the security check
+// so small rings can be used to sweep parameters.
+lbcrypto::CryptoContext<lbcrypto::DCRTPoly> makeBenchContext(uint32_t multDepth, uint32_t ringDim);
+
+std::vector<double> randomUnitVector(size_t dim, unsigned seed);
+
+void printResult(const BenchResult& result);
+
+// {"context": {...}, "benchmarks": [{name, params, iterations, seconds, counters}, ...]}
+void writeJson(const std::string& path, const std::vector<BenchResult>& results);
+
+// One point of a suite that runs the whole system: the system, a gallery of
+// numVectors test templates and one probe. Results recorded through it carry
+// the point's params.
+struct BenchPoint {
+    std::unique_ptr<ThresholdBiometricSystem> system;
+    TemplateMatrix<double> vectors;
+    TemplateMatrix<double> probe;
+    std::map<std::string, std::string> params;
+    std::vector<BenchResult>* results = nullptr;
+
+    void record(BenchResult r) const {
+        r.params = params;
+        results->push_back(std::move(r));
+    }
+};
+
+// builds the point quietly; prints "skipping <label>: <why>" and returns nullopt
+// when the configuration is rejected (e.g. insecure or too small a ring)
+std::optional<BenchPoint> makeBenchPoint(const AppConfig& config, const std::string& label,
+                                         std::vector<BenchResult>& results);
+
+// discards std::cout while alive, for code that reports progress on every call
+class ScopedSilence {
+public:
+    ScopedSilence() : m_saved(std::cout.rdbuf(nullptr)) {}
+    ~ScopedSilence() { std::cout.rdbuf(m_saved); }
+    ScopedSilence(const ScopedSilence&) = delete;
+    ScopedSilence& operator=(const ScopedSilence&) = delete;
+
+private:
+    std::streambuf* m_saved;
+};
+
+#endif // BENCH_HARNESS_H
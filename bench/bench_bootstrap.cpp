@@ -0,0 +1,122 @@
+#include "BenchHarness.h"
+#include "ComparisonKernel.h"
+#include "GalleryFile.h"
+#include "PlaintextSimilarity.h"
+#include "ReductionPlanner.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+// Per-template cost of the streaming maximum with a fixed depth budget against
+// bootstrapping the running maximum between batches. The fixed mode takes the
+// planner's depth and ring for the gallery; where no ring holds that depth it
+// runs at the deepest secure depth of the largest ring and averages the merges
+// that do not fit, which shows up in averaged_merges and error_vs_plaintext.
+namespace {
+
+uint32_t deepestSecureDepth(uint32_t ringDim) {
+    uint32_t depth = 1;
+    for (uint32_t ring; (ring = minimumRingDimension(depth + 1, 60, 50)) != 0 && ring <= ringDim; ) ++depth;
+    return depth;
+}
+
+bool planFits(const AppConfig& config) {
+    ReductionPlanInput input;
+    input.numVectors = config.numVectors;
+    input.vecDim = config.vecDim;
+    input.batchSize = config.batchSize;
+    input.targetError = config.targetError;
+    input.mergeDepth = [variant = config.comparison](const SignApproximation& sign) {
+        return ComparisonKernel::levels(sign, variant);
+    };
+    try {
+        planReduction(input);
+        return true;
+    } catch (const runtime_error&) {
+        return false;
+    }
+}
+
+void runPoint(const BenchOptions& opts, AppConfig config, const string& mode, vector<BenchResult>& results) {
+    auto point = makeBenchPoint(config, mode + " at " + to_string(config.numVectors) + " templates", results);
+    if (!point) return;
+    auto& sys = *point->system;
+    const auto& vectors = point->vectors;
+    const auto& probe = point->probe;
+    const double expected = scoreTemplates(probe, vectors, 1, config.threshold).topK[0][0].score;
+
+    point->params = {
+        {"gallery", to_string(config.numVectors)},
+        {"mode", mode},
+        {"depth", to_string(sys.config().multDepth)},
+        {"ring", to_string(sys.cryptoContext()->GetRingDimension())},
+        {"batchSize", to_string(sys.config().batchSize)},
+    };
+    auto record = [&](BenchResult r) { point->record(move(r)); };
+
+    ScopedSilence quiet;
+    // a gallery of 100k templates is encrypted once, not per iteration
+    BenchOptions once = opts;
+    once.minIterations = 1;
+    once.minSeconds = 0.0;
+    auto encrypt = measure("bootstrap/encrypt", once, [&] { sys.encryptVectorDatabaseToFile(vectors); });
+    auto gallery = sys.openGallery(config.galleryPath);
+    encrypt.counters["ms_per_template"] = encrypt.secondsPerIteration() * 1e3 / config.numVectors;
+    encrypt.counters["bytes_per_template"] = (double)gallery->fileSize() / config.numVectors;
+    record(encrypt);
+
+    sys.ensureEvalKeys();
+    auto encQuery = sys.encryptQueryVector(probe.copyRow(0));
+    Ciphertext<DCRTPoly> maxCt;
+    size_t bootstraps = 0;
+    size_t averaged = 0;
+    auto query = measure("bootstrap/query", once, [&] {
+        maxCt = sys.computeStreamingApproximation(*gallery, encQuery);
+        bootstraps += sys.bootstraps();
+        averaged += sys.averagedMerges();
+    });
+    const double result = sys.thresholdDecryptResult(maxCt);
+    query.counters["ms_per_template"] = query.secondsPerIteration() * 1e3 / config.numVectors;
+    query.counters["bootstraps"] = (double)bootstraps / query.iterations;
+    query.counters["averaged_merges"] = (double)averaged / query.iterations;
+    query.counters["error_vs_plaintext"] = fabs(result - expected);
+    record(query);
+
+    gallery.reset();
+    remove(config.galleryPath.c_str());
+}
+
+} // namespace
+
+void benchBootstrap(const BenchOptions& opts, vector<BenchResult>& results) {
+    for (size_t gallerySize : opts.bootstrapGallerySizes) {
+        AppConfig config;
+        config.vecDim = opts.vecDim;
+        config.numVectors = gallerySize;
+        config.galleryPath = "bench_bootstrap.bin";
+
+        cerr << "* bootstrap: fixed depth, " << gallerySize << " templates" << endl;
+        AppConfig fixed = config;
+        if (planFits(fixed)) {
+            fixed.autoParams = true;
+        } else {
+            fixed.ringDim = 131072;
+            fixed.multDepth = deepestSecureDepth(fixed.ringDim);
+        }
+        runPoint(opts, fixed, "fixed", results);
+
+        cerr << "* bootstrap: bootstrapping, " << gallerySize << " templates" << endl;
+        AppConfig refreshed = config;
+        refreshed.bootstrap = true;
+        runPoint(opts, refreshed, "bootstrap", results);
+    }
+}
@@ -0,0 +1,78 @@
+#include "BenchHarness.h"
+#include "ComparisonKernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+// One polyMax per variant and sign approximation: wall time, levels and key
+// switches, and the worst slot error against the plaintext maximum. The planner
+// budgets cost().levels per comparison, so a kernel that consumes more fails.
+void benchComparison(const BenchOptions& opts, vector<BenchResult>& results) {
+    auto cc = makeBenchContext(opts.multDepth, opts.ringDim);
+    size_t slots = cc->GetEncodingParams()->GetBatchSize();
+
+    auto kp = cc->KeyGen();
+    cc->EvalMultKeyGen(kp.secretKey);
+
+    // similarity-like scores in [0, 1]
+    mt19937 gen(3);
+    uniform_real_distribution<double> dist(0.0, 1.0);
+    vector<double> a(slots), b(slots);
+    for (size_t i = 0; i < slots; ++i) {
+        a[i] = dist(gen);
+        b[i] = dist(gen);
+    }
+    auto ctA = cc->Encrypt(kp.publicKey, cc->MakeCKKSPackedPlaintext(a));
+    auto ctB = cc->Encrypt(kp.publicKey, cc->MakeCKKSPackedPlaintext(b));
+
+    struct Case {
+        ComparisonVariant variant;
+        SignApproximation sign;
+    };
+    vector<Case> cases = {{ComparisonVariant::Reference, {3, 1, 1.0}}};
+    for (SignApproximation sign : {SignApproximation{3, 1, 1.0}, SignApproximation{5, 2, 1.0}, SignApproximation{7, 2, 1.0}}) {
+        for (auto v : {ComparisonVariant::Fused, ComparisonVariant::Lazy, ComparisonVariant::Chebyshev}) {
+            cases.push_back({v, sign});
+        }
+    }
+
+    for (const auto& c : cases) {
+        ComparisonKernel kernel(cc, c.sign, c.variant);
+        auto cost = kernel.cost();
+        if (cost.levels > opts.multDepth) continue;
+
+        string name = string("compare/") + ComparisonKernel::name(c.variant) + "/deg" + to_string(c.sign.degree) +
+                      "x" + to_string(c.sign.iterations);
+        Ciphertext<DCRTPoly> out;
+        auto r = measure(name, opts, [&] { out = kernel.max(ctA, ctB); });
+
+        Plaintext pt;
+        cc->Decrypt(kp.secretKey, out, &pt);
+        pt->SetLength(slots);
+        auto values = pt->GetRealPackedValue();
+        double maxError = 0.0;
+        for (size_t i = 0; i < slots; ++i) maxError = max(maxError, fabs(values[i] - max(a[i], b[i])));
+
+        r.params = {
+            {"ring", to_string(cc->GetRingDimension())},
+            {"depth", to_string(opts.multDepth)},
+        };
+        const uint32_t measured = (uint32_t)(out->GetLevel() + out->GetNoiseScaleDeg() - 1);
+        r.counters["levels"] = cost.levels;
+        r.counters["levels_measured"] = measured;
+        if (measured > cost.levels) {
+            r.failure = "consumed " + to_string(measured) + " levels, the planner budgets " + to_string(cost.levels);
+        }
+        r.counters["key_switches"] = (double)cost.keySwitches;
+        r.counters["max_error"] = maxError;
+        r.counters["model_error"] = c.variant == ComparisonVariant::Reference ? polyMaxError(c.sign, 1.0)
+                                                                               : polyMaxError(c.sign, 1.0 / c.sign.inputScale);
+        r.counters["compares_per_s"] = r.iterations / r.seconds;
+        results.push_back(r);
+    }
+}
@@ -0,0 +1,153 @@
+#include "BenchHarness.h"
+#include "argparse.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+void benchRotations(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchComparison(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchStages(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchStorage(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchPlaintext(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchBootstrap(const BenchOptions& opts, std::vector<BenchResult>& results);
+void benchSharding(const BenchOptions& opts, std::vector<BenchResult>& results);
+
+int main(int argc, char** argv) {
+    argparse::ArgumentParser program("biometric_bench");
+
+    program.add_argument("--filter")
+        .help("Only run suites whose name contains this string")
+        .default_value(std::string(""));
+
+    program.add_argument("--mult-depth")
+        .help("Multiplicative depth of the benchmark context")
+        .default_value(10u)
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--ring-dim")
+        .help("Ring dimension (0 = smallest secure ring for the depth)")
+        .default_value(0u)
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--vec-dim")
+        .help("Template dimension")
+        .default_value(512ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--min-iterations")
+        .help("Minimum iterations per measurement")
+        .default_value(3ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--min-seconds")
+        .help("Minimum wall time per measurement")
+        .default_value(1.0)
+        .scan<'g', double>();
+
+    program.add_argument("--grid-vec-dim")
+        .help("Template dimensions of the stage grid (default: --vec-dim)")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', size_t>();
+
+    program.add_argument("--grid-ring-dim")
+        .help("Ring dimensions of the stage grid (default: --ring-dim)")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--grid-depth")
+        .help("Multiplicative depths of the stage grid (default: --mult-depth)")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--grid-gallery")
+        .help("Gallery sizes of the stage grid")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', size_t>();
+
+    program.add_argument("--bootstrap-gallery")
+        .help("Gallery sizes of the bootstrap suite (default: 1000; the README's comparison uses 10000 100000)")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', size_t>();
+
+    program.add_argument("--sharding-workers")
+        .help("Shard worker process counts of the sharding suite (default: 1 2 4)")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'u', size_t>();
+
+    program.add_argument("--sharding-gallery")
+        .help("Gallery size of the sharding suite")
+        .default_value(4096ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--verify-binary")
+        .help("biometric_verify executable the sharding suite starts as workers (default: next to this binary)")
+        .default_value(std::string(""));
+
+    program.add_argument("--json")
+        .help("Also write all results to this JSON file")
+        .default_value(std::string(""));
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    BenchOptions opts;
+    opts.filter = program.get<std::string>("--filter");
+    opts.multDepth = program.get<uint32_t>("--mult-depth");
+    opts.ringDim = program.get<uint32_t>("--ring-dim");
+    opts.vecDim = program.get<size_t>("--vec-dim");
+    opts.minIterations = program.get<size_t>("--min-iterations");
+    opts.minSeconds = program.get<double>("--min-seconds");
+    opts.gridVecDims = program.present<std::vector<size_t>>("--grid-vec-dim").value_or(std::vector<size_t>{opts.vecDim});
+    opts.gridRingDims = program.present<std::vector<uint32_t>>("--grid-ring-dim").value_or(std::vector<uint32_t>{opts.ringDim});
+    opts.gridDepths = program.present<std::vector<uint32_t>>("--grid-depth").value_or(std::vector<uint32_t>{opts.multDepth});
+    opts.gridGallerySizes = program.present<std::vector<size_t>>("--grid-gallery").value_or(std::vector<size_t>{64});
+    opts.bootstrapGallerySizes = program.present<std::vector<size_t>>("--bootstrap-gallery").value_or(std::vector<size_t>{1000});
+    opts.shardingWorkers = program.present<std::vector<size_t>>("--sharding-workers").value_or(std::vector<size_t>{1, 2, 4});
+    opts.shardingGallerySize = program.get<size_t>("--sharding-gallery");
+    opts.verifyBinary = program.get<std::string>("--verify-binary");
+    if (opts.verifyBinary.empty()) opts.verifyBinary = (std::filesystem::path(argv[0]).parent_path() / "biometric_verify").string();
+    const auto jsonPath = program.get<std::string>("--json");
+
+    const std::vector<std::pair<std::string, std::function<void(const BenchOptions&, std::vector<BenchResult>&)>>> suites = {
+        {"rotations", benchRotations},
+        {"comparison", benchComparison},
+        {"stages", benchStages},
+        {"storage", benchStorage},
+        {"plaintext", benchPlaintext},
+        {"bootstrap", benchBootstrap},
+        {"sharding", benchSharding},
+    };
+
+    try {
+        std::vector<BenchResult> all;
+        for (const auto& [name, suite] : suites) {
+            if (name.find(opts.filter) == std::string::npos) continue;
+            std::vector<BenchResult> results;
+            suite(opts, results);
+            for (const auto& r : results) printResult(r);
+            all.insert(all.end(), results.begin(), results.end());
+        }
+        if (!jsonPath.empty()) {
+            writeJson(jsonPath, all);
+            std::cout << "* Wrote " << all.size() << " results to " << jsonPath << std::endl;
+        }
+        size_t failed = 0;
+        for (const auto& r : all) failed += !r.failure.empty();
+        if (failed > 0) {
+            std::cerr << "\n" << failed << " of " << all.size() << " results failed their checks" << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "\nFATAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
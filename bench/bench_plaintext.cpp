@@ -0,0 +1,116 @@
+#include "BenchHarness.h"
+#include "PlaintextSimilarity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// unit-normalized templates drawn like generateTestVectors, without its logging
+TemplateMatrix<double> randomTemplates(size_t rows, size_t dim, unsigned seed) {
+    TemplateMatrix<double> m(rows, dim);
+    mt19937 gen(seed);
+    normal_distribution<double> dist(0.0, 1.0);
+    for (size_t i = 0; i < rows; ++i) {
+        auto v = m.row(i);
+        double norm = 0.0;
+        for (double& x : v) {
+            x = dist(gen);
+            norm += x * x;
+        }
+        norm = sqrt(norm);
+        for (double& x : v) x /= norm;
+    }
+    return m;
+}
+
+// the scalar per-query loops the demo used for its plaintext baseline
+void loopBaseline(const vector<vector<double>>& queries, const vector<vector<double>>& db, double threshold,
+                  vector<size_t>& best, vector<size_t>& matches) {
+    best.assign(queries.size(), 0);
+    matches.assign(queries.size(), 0);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        double maxSim = -2.0;
+        for (size_t idx = 0; idx < db.size(); ++idx) {
+            double sim = 0.0;
+            for (size_t i = 0; i < queries[q].size(); ++i) sim += queries[q][i] * db[idx][i];
+            if (sim > maxSim) {
+                maxSim = sim;
+                best[q] = idx;
+            }
+        }
+        for (const auto& v : db) {
+            double sim = 0.0;
+            for (size_t i = 0; i < queries[q].size(); ++i) sim += queries[q][i] * v[i];
+            if (sim > threshold) ++matches[q];
+        }
+    }
+}
+
+vector<vector<double>> toNested(const TemplateMatrix<double>& m) {
+    vector<vector<double>> nested;
+    for (size_t i = 0; i < m.rows(); ++i) nested.push_back(m.copyRow(i));
+    return nested;
+}
+
+} // namespace
+
+// The contiguous, blocked similarity kernel against the scalar loop it replaces,
+// per gallery size and query count. "agrees" is 1 when top-1 indices and the
+// threshold counts match the loop exactly.
+void benchPlaintext(const BenchOptions& opts, vector<BenchResult>& results) {
+    const double threshold = 0.1;   // random 512D templates rarely exceed the demo's 0.85
+    const size_t cores = max(1u, thread::hardware_concurrency());
+    for (size_t gallerySize : opts.gridGallerySizes) {
+        for (size_t numQueries : {size_t(1), size_t(16)}) {
+            cerr << "* plaintext: " << gallerySize << " templates x " << opts.vecDim << "D, " << numQueries
+                 << " queries" << endl;
+            auto gallery = randomTemplates(gallerySize, opts.vecDim, 42);
+            auto queries = randomTemplates(numQueries, opts.vecDim, 7);
+            const double flops = 2.0 * gallerySize * numQueries * opts.vecDim;
+            map<string, string> params = {
+                {"gallery", to_string(gallerySize)},
+                {"queries", to_string(numQueries)},
+                {"vecDim", to_string(opts.vecDim)},
+            };
+
+            vector<size_t> loopBest, loopMatches;
+            {
+                auto nestedGallery = toNested(gallery);
+                auto nestedQueries = toNested(queries);
+                auto loop = measure("plaintext/loop", opts, [&] {
+                    loopBaseline(nestedQueries, nestedGallery, threshold, loopBest, loopMatches);
+                });
+                loop.params = params;
+                // the loop walks the gallery twice per query: once for the max, once for the count
+                loop.counters["gflops"] = 2 * flops * loop.iterations / loop.seconds / 1e9;
+                results.push_back(loop);
+            }
+            const double loopSeconds = results.back().secondsPerIteration();
+
+            auto run = [&](const string& name, const auto& q, const auto& g, size_t threads) {
+                SimilarityReport report;
+                auto r = measure(name, opts, [&] { report = scoreTemplates(q, g, 1, threshold, threads); });
+                r.params = params;
+                r.params["threads"] = to_string(threads);
+                r.counters["gflops"] = flops * r.iterations / r.seconds / 1e9;
+                r.counters["speedup_vs_loop"] = loopSeconds / r.secondsPerIteration();
+                bool agrees = report.aboveThreshold == loopMatches;
+                for (size_t i = 0; i < numQueries; ++i) agrees = agrees && report.topK[i][0].index == loopBest[i];
+                r.counters["agrees"] = agrees;
+                results.push_back(r);
+            };
+            run("plaintext/f64", queries, gallery, 1);
+            if (cores > 1) run("plaintext/f64", queries, gallery, cores);
+            TemplateMatrix<float> galleryF(gallery), queriesF(queries);
+            run("plaintext/f32", queriesF, galleryF, 1);
+            if (cores > 1) run("plaintext/f32", queriesF, galleryF, cores);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#include "BenchHarness.h"
+#include "DotProductEngine.h"
+
+#include <algorithm>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+// Serial EvalRotate vs hoisted EvalFastRotation throughput, and the
+// resulting cost of one block-local dot product for each rotation radix.
+void benchRotations(const BenchOptions& opts, vector<BenchResult>& results) {
+    auto cc = makeBenchContext(opts.multDepth, opts.ringDim);
+    size_t slots = cc->GetEncodingParams()->GetBatchSize();
+    size_t stride = min(opts.vecDim, slots);
+
+    vector<size_t> radices;
+    for (size_t r = 2; r <= min<size_t>(stride, 32); r <<= 1) radices.push_back(r);
+
+    vector<int32_t> indices;
+    for (size_t radix : radices) {
+        auto keys = DotProductEngine(cc, stride, radix).rotationIndices();
+        indices.insert(indices.end(), keys.begin(), keys.end());
+    }
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+
+    auto kp = cc->KeyGen();
+    cc->EvalMultKeyGen(kp.secretKey);
+    cc->EvalRotateKeyGen(kp.secretKey, indices);
+
+    auto ct = cc->Encrypt(kp.publicKey, cc->MakeCKKSPackedPlaintext(randomUnitVector(stride, 1)));
+    uint32_t m = cc->GetCyclotomicOrder();
+    const size_t fanOut = 8;
+
+    map<string, string> params = {
+        {"ring", to_string(cc->GetRingDimension())},
+        {"depth", to_string(opts.multDepth)},
+        {"vecDim", to_string(stride)},
+    };
+
+    auto serial = measure("rotate/serial", opts, [&] {
+        for (size_t k = 1; k <= fanOut; ++k) cc->EvalRotate(ct, indices[(k - 1) % indices.size()]);
+    });
+    serial.params = params;
+    serial.counters["rotations_per_s"] = fanOut * serial.iterations / serial.seconds;
+    results.push_back(serial);
+
+    auto hoisted = measure("rotate/hoisted", opts, [&] {
+        auto digits = cc->EvalFastRotationPrecompute(ct);
+        for (size_t k = 1; k <= fanOut; ++k) {
+            cc->EvalFastRotation(ct, indices[(k - 1) % indices.size()], m, digits);
+        }
+    });
+    hoisted.params = params;
+    hoisted.counters["rotations_per_s"] = fanOut * hoisted.iterations / hoisted.seconds;
+    results.push_back(hoisted);
+
+    for (size_t radix : radices) {
+        DotProductEngine engine(cc, stride, radix);
+        auto r = measure("dot/radix" + to_string(radix), opts, [&] { engine.dot(ct, ct); });
+        r.params = params;
+        r.counters["rotations"] = (double)engine.rotationsPerDot();
+        r.counters["decompositions"] = (double)engine.keySwitchDecompositionsPerDot();
+        r.counters["rotations_per_s"] = engine.rotationsPerDot() * r.iterations / r.seconds;
+        r.counters["dots_per_s"] = r.iterations / r.seconds;
+        results.push_back(r);
+    }
+}
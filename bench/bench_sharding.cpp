@@ -0,0 +1,153 @@
+#include "BenchHarness.h"
+#include "PlaintextSimilarity.h"
+#include "Protocol.h"
+#include "ShardAggregator.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+using namespace lbcrypto;
+using namespace std;
+
+// Query latency of the scatter/gather aggregator over 1, 2, 4, ... shard
+// worker processes against one gallery. Each worker is a biometric_verify
+// --serve --shard process with one worker thread; the aggregator runs in this
+// process and is timed around computeMax.
+namespace {
+
+class WorkerProcesses {
+public:
+    WorkerProcesses(const string& binary, const string& keystore, const string& gallery, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            string socket = "bench_shard" + to_string(i) + ".sock";
+            vector<string> args = {binary, "--keystore", keystore, "--gallery", gallery, "--serve", socket,
+                                   "--shard", to_string(i) + "/" + to_string(count), "--worker-threads", "1"};
+            spawn(args);
+            m_sockets.push_back(socket);
+        }
+    }
+
+    ~WorkerProcesses() {
+        for (pid_t pid : m_pids) kill(pid, SIGTERM);
+        for (pid_t pid : m_pids) waitpid(pid, nullptr, 0);
+        for (const auto& socket : m_sockets) remove(socket.c_str());
+    }
+
+    WorkerProcesses(const WorkerProcesses&) = delete;
+    WorkerProcesses& operator=(const WorkerProcesses&) = delete;
+
+    const vector<string>& sockets() const { return m_sockets; }
+
+    // workers load the key store and map the gallery before they listen
+    void waitUntilListening(chrono::seconds timeout) const {
+        auto deadline = chrono::steady_clock::now() + timeout;
+        for (const auto& socket : m_sockets) {
+            while (true) {
+                try {
+                    connectUnix(socket);
+                    break;
+                } catch (const exception&) {
+                }
+                for (pid_t pid : m_pids) {
+                    if (waitpid(pid, nullptr, WNOHANG) == pid) throw runtime_error("a shard worker exited during startup");
+                }
+                if (chrono::steady_clock::now() > deadline) throw runtime_error("shard worker on " + socket + " did not start");
+                this_thread::sleep_for(chrono::milliseconds(100));
+            }
+        }
+    }
+
+private:
+    void spawn(const vector<string>& args) {
+        vector<char*> argv;
+        for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        // workers log every query; keep their stderr for failures
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        pid_t pid;
+        int rc = posix_spawn(&pid, args[0].c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (rc != 0) throw runtime_error("Cannot start " + args[0] + ": " + strerror(rc));
+        m_pids.push_back(pid);
+    }
+
+    vector<pid_t> m_pids;
+    vector<string> m_sockets;
+};
+
+} // namespace
+
+void benchSharding(const BenchOptions& opts, vector<BenchResult>& results) {
+    if (!filesystem::exists(opts.verifyBinary)) {
+        cerr << "  - skipping sharding: " << opts.verifyBinary << " not found (set --verify-binary)" << endl;
+        return;
+    }
+
+    AppConfig config;
+    config.vecDim = opts.vecDim;
+    config.numVectors = opts.shardingGallerySize;
+    config.autoParams = true;
+    config.keystoreDir = "bench_sharding_keys";
+    config.initKeys = true;
+    config.galleryPath = "bench_sharding.bin";
+
+    cerr << "* sharding: " << config.numVectors << " templates, workers";
+    for (size_t workers : opts.shardingWorkers) cerr << " " << workers;
+    cerr << endl;
+
+    double singleWorkerSeconds = 0.0;
+    {
+        ScopedSilence quiet;
+        ThresholdBiometricSystem system(config);
+        auto vectors = system.generateTestVectors(config.numVectors, config.vecDim);
+        auto probe = system.generateTestVectors(1, config.vecDim);
+        const double expected = scoreTemplates(probe, vectors, 1, config.threshold).topK[0][0].score;
+        system.encryptVectorDatabaseToFile(vectors);
+        system.ensureEvalKeys();
+        auto encQuery = system.encryptQueryVector(probe.copyRow(0));
+
+        for (size_t workers : opts.shardingWorkers) {
+            WorkerProcesses processes(opts.verifyBinary, config.keystoreDir, config.galleryPath, workers);
+            processes.waitUntilListening(chrono::seconds(600));
+            // one piece per worker keeps the aggregator's extra merges at log2(workers)
+            ShardAggregator aggregator(system, config.galleryPath, processes.sockets(), 1);
+
+            Ciphertext<DCRTPoly> maxCt;
+            auto r = measure("sharding/query", opts, [&] { maxCt = aggregator.computeMax(encQuery); });
+            const double result = system.thresholdDecryptResult(maxCt);
+            if (workers == 1) singleWorkerSeconds = r.secondsPerIteration();
+
+            r.params = {
+                {"gallery", to_string(config.numVectors)},
+                {"workers", to_string(workers)},
+                {"ring", to_string(system.cryptoContext()->GetRingDimension())},
+            };
+            r.counters["ms_per_query"] = r.secondsPerIteration() * 1e3;
+            if (singleWorkerSeconds > 0.0) r.counters["speedup_vs_1"] = singleWorkerSeconds / r.secondsPerIteration();
+            r.counters["error_vs_plaintext"] = fabs(result - expected);
+            results.push_back(move(r));
+        }
+    }
+
+    remove(config.galleryPath.c_str());
+    filesystem::remove_all(config.keystoreDir);
+}
@@ -0,0 +1,113 @@
+#include "BenchHarness.h"
+#include "GalleryFile.h"
+#include "OnlineTournament.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+// Times each stage of ThresholdBiometricSystem on its own, for every point of
+// the vecDim x ring x depth x gallery-size grid. Points OpenFHE rejects as
+// insecure (or too small for the template) are skipped.
+namespace {
+
+void runPoint(const BenchOptions& opts, AppConfig config, vector<BenchResult>& results) {
+    auto point = makeBenchPoint(config, to_string(config.vecDim) + "D / ring " + to_string(config.ringDim) +
+                                " / depth " + to_string(config.multDepth), results);
+    if (!point) return;
+    auto& sys = *point->system;
+    const auto& vectors = point->vectors;
+    auto cc = sys.cryptoContext();
+
+    point->params = {
+        {"vecDim", to_string(config.vecDim)},
+        {"ring", to_string(cc->GetRingDimension())},
+        {"depth", to_string(config.multDepth)},
+        {"gallery", to_string(config.numVectors)},
+        {"perCiphertext", to_string(sys.layout().templatesPerCiphertext)},
+    };
+    auto record = [&](BenchResult r) { point->record(move(r)); };
+
+    ScopedSilence quiet;
+
+    auto encrypt = measure("stage/encrypt_gallery", opts, [&] { sys.encryptVectorDatabaseToFile(vectors); });
+    auto gallery = sys.openGallery(config.galleryPath);
+    const size_t records = gallery->recordCount();
+    encrypt.counters["templates_per_s"] = config.numVectors * encrypt.iterations / encrypt.seconds;
+    encrypt.counters["file_mib"] = gallery->fileSize() / (1024.0 * 1024.0);
+    record(encrypt);
+
+    auto deserialize = measure("stage/deserialize", opts, [&] {
+        for (size_t i = 0; i < records; ++i) gallery->loadRecord(i);
+    });
+    deserialize.counters["records_per_s"] = records * deserialize.iterations / deserialize.seconds;
+    deserialize.counters["mib_per_s"] = gallery->fileSize() / (1024.0 * 1024.0) * deserialize.iterations / deserialize.seconds;
+    record(deserialize);
+
+    sys.ensureEvalKeys();
+    auto encQuery = sys.encryptQueryVector(vectors.copyRow(0));
+    auto first = gallery->loadRecord(0);
+    auto second = gallery->loadRecord(min<size_t>(1, records - 1));
+    Ciphertext<DCRTPoly> sim;
+    auto similarity = measure("stage/similarity", opts, [&] { sim = sys.computeCosineSimilarity(encQuery, first); });
+    similarity.counters["templates_per_s"] = sys.layout().templatesPerCiphertext * similarity.iterations / similarity.seconds;
+    record(similarity);
+
+    auto simB = sys.computeCosineSimilarity(encQuery, second);
+    Ciphertext<DCRTPoly> maxCt;
+    auto polyMax = measure("stage/polymax", opts, [&] { maxCt = sys.polyMax(sim, simB); });
+    polyMax.counters["levels"] = sys.comparisonKernel().cost().levels;
+    record(polyMax);
+
+    // the serial batch reduction on one batch worth of similarities
+    vector<Ciphertext<DCRTPoly>> sims;
+    for (size_t i = 0; i < min(records, config.batchSize); ++i) {
+        sims.push_back(sys.computeCosineSimilarity(encQuery, gallery->loadRecord(i)));
+    }
+    Ciphertext<DCRTPoly> batchMax;
+    auto batch = measure("stage/batch_reduce", opts, [&] {
+        OnlineTournament tournament(
+            [&](const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) { return sys.tournamentMerge(a, b); },
+            sims.size());
+        for (const auto& s : sims) tournament.push(s);
+        batchMax = tournament.finish();
+    });
+    batch.counters["merges"] = (double)(sims.size() - 1);
+    batch.counters["output_level"] = (double)(batchMax->GetLevel() + batchMax->GetNoiseScaleDeg() - 1);
+    record(batch);
+
+    auto decrypt = measure("stage/threshold_decrypt", opts, [&] { sys.thresholdDecryptResult(batchMax); });
+    record(decrypt);
+
+    gallery.reset();
+    remove(config.galleryPath.c_str());
+}
+
+} // namespace
+
+void benchStages(const BenchOptions& opts, vector<BenchResult>& results) {
+    for (size_t vecDim : opts.gridVecDims) {
+        for (uint32_t ringDim : opts.gridRingDims) {
+            for (uint32_t depth : opts.gridDepths) {
+                for (size_t gallerySize : opts.gridGallerySizes) {
+                    AppConfig config;
+                    config.vecDim = vecDim;
+                    config.ringDim = ringDim;
+                    config.multDepth = depth;
+                    config.numVectors = gallerySize;
+                    config.galleryPath = "bench_gallery.bin";
+                    cerr << "* stages: " << vecDim << "D, ring " << ringDim << ", depth " << depth << ", "
+                         << gallerySize << " templates" << endl;
+                    runPoint(opts, config, results);
+                }
+            }
+        }
+    }
+}
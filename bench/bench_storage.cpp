@@ -0,0 +1,114 @@
+#include "BenchHarness.h"
+#include "GalleryFile.h"
+#include "PlaintextSimilarity.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+// Gallery size and read bandwidth per storage mode (full level, reduced level,
+// reduced level + zstd), plus a round trip through computeStreamingApproximation:
+// every mode must decrypt to the same maximum as the full-level gallery.
+namespace {
+
+// a storage mode only changes where the query meets the record, not the circuit,
+// so its result may differ from the full-level one by CKKS noise alone
+constexpr double kDeltaTolerance = 1e-3;
+
+void runPoint(const BenchOptions& opts, AppConfig config, vector<BenchResult>& results) {
+    auto point = makeBenchPoint(config, to_string(config.numVectors) + " templates / depth " + to_string(config.multDepth),
+                                results);
+    if (!point) return;
+    auto& sys = *point->system;
+    const auto& vectors = point->vectors;
+    const auto& probe = point->probe;
+    const double expected = scoreTemplates(probe, vectors, 1, config.threshold).topK[0][0].score;
+    const uint32_t spare = config.multDepth - min(config.multDepth, sys.queryCircuitDepth());
+
+    struct Mode {
+        string name;
+        uint32_t dropLevels;
+        bool compress;
+    };
+    vector<Mode> modes = {{"full", 0, false}, {"reduced", spare, false}};
+    if (compressionAvailable(GalleryCompression::Zstd)) modes.push_back({"reduced_zstd", spare, true});
+
+    ScopedSilence quiet;
+    sys.ensureEvalKeys();
+    auto encQuery = sys.encryptQueryVector(probe.copyRow(0));
+    double fullResult = 0.0;
+    for (const auto& mode : modes) {
+        sys.setGalleryStorage(mode.dropLevels, mode.compress);
+        point->params = {
+            {"gallery", to_string(config.numVectors)},
+            {"depth", to_string(config.multDepth)},
+            {"mode", mode.name},
+            {"dropLevels", to_string(mode.dropLevels)},
+        };
+        auto record = [&](BenchResult r) { point->record(move(r)); };
+
+        auto encrypt = measure("storage/encrypt", opts, [&] { sys.encryptVectorDatabaseToFile(vectors); });
+        auto gallery = sys.openGallery(config.galleryPath);
+        const size_t records = gallery->recordCount();
+        encrypt.counters["bytes_per_template"] = (double)gallery->fileSize() / config.numVectors;
+        encrypt.counters["file_mib"] = gallery->fileSize() / (1024.0 * 1024.0);
+        encrypt.counters["stored_level"] = (double)gallery->loadRecord(0)->GetLevel();
+        record(encrypt);
+
+        auto deserialize = measure("storage/deserialize", opts, [&] {
+            for (size_t i = 0; i < records; ++i) gallery->loadRecord(i);
+        });
+        deserialize.counters["records_per_s"] = records * deserialize.iterations / deserialize.seconds;
+        deserialize.counters["file_mib_per_s"] = gallery->fileSize() / (1024.0 * 1024.0) * deserialize.iterations / deserialize.seconds;
+        record(deserialize);
+
+        Ciphertext<DCRTPoly> maxCt;
+        size_t averaged = 0;
+        auto query = measure("storage/query", opts, [&] {
+            maxCt = sys.computeStreamingApproximation(*gallery, encQuery);
+            averaged += sys.averagedMerges();
+        });
+        const double result = sys.thresholdDecryptResult(maxCt);
+        if (mode.dropLevels == 0 && !mode.compress) fullResult = result;
+        query.counters["error_vs_plaintext"] = fabs(result - expected);
+        query.counters["delta_vs_full"] = fabs(result - fullResult);
+        query.counters["averaged_merges"] = (double)averaged / query.iterations;
+        query.counters["output_level"] = (double)maxCt->GetLevel();
+        // averaged merges trade accuracy for depth on purpose; otherwise the planner bounds the error
+        if (averaged == 0 && query.counters["error_vs_plaintext"] > config.targetError) {
+            query.failure = "error vs plaintext " + to_string(query.counters["error_vs_plaintext"]) +
+                            " exceeds the target error " + to_string(config.targetError);
+        } else if (query.counters["delta_vs_full"] > kDeltaTolerance) {
+            query.failure = "result differs from the full-level gallery by " + to_string(query.counters["delta_vs_full"]) +
+                            " (tolerance " + to_string(kDeltaTolerance) + ")";
+        }
+        record(query);
+
+        gallery.reset();
+        remove(config.galleryPath.c_str());
+    }
+}
+
+} // namespace
+
+void benchStorage(const BenchOptions& opts, vector<BenchResult>& results) {
+    for (uint32_t depth : opts.gridDepths) {
+        for (size_t gallerySize : opts.gridGallerySizes) {
+            AppConfig config;
+            config.vecDim = opts.vecDim;
+            config.ringDim = opts.ringDim;
+            config.multDepth = depth;
+            config.numVectors = gallerySize;
+            config.galleryPath = "bench_storage.bin";
+            cerr << "* storage: depth " << depth << ", " << gallerySize << " templates" << endl;
+            runPoint(opts, config, results);
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#include "ComparisonKernel.h"
+#include "CountedEval.h"
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+double evalPolynomial(const vector<double>& coeffs, double x) {
+    double y = 0.0;
+    for (size_t k = coeffs.size(); k-- > 0; ) y = y * x + coeffs[k];
+    return y;
+}
+
+// relinearizations of one lazily evaluated odd polynomial: the reused powers
+// (x^2, x^4, and (c7 x) x^2 for degree 7) plus one for the summed terms
+size_t lazyKeySwitches(size_t degree) {
+    return degree == 3 ? 2 : (degree == 5 ? 3 : 4);
+}
+
+// OpenFHE's depth table for EvalChebyshevSeries (Paterson-Stockmeyer past degree 5):
+// the highest degree each depth from 3 on evaluates; 0 past the end of the table
+uint32_t chebyshevDepth(size_t degree) {
+    static constexpr size_t kMaxDegree[] = {5, 13, 27, 59, 119, 247, 495, 1007, 2031};
+    for (uint32_t i = 0; i < size(kMaxDegree); ++i) {
+        if (degree <= kMaxDegree[i]) return 3 + i;
+    }
+    return 0;
+}
+
+size_t compositeDegree(const SignApproximation& sign) {
+    size_t degree = 1;
+    for (size_t i = 0; i < sign.iterations; ++i) degree *= sign.degree;
+    return degree;
+}
+
+// non-scalar products of a Paterson-Stockmeyer evaluation: baby steps T_2..T_k,
+// giant steps T_2k..T_2^(m-1)k, and the 2^(m-1) - 1 recombinations
+size_t chebyshevKeySwitches(size_t degree) {
+    if (degree < 5) return degree - 1;
+    size_t best = SIZE_MAX;
+    for (size_t m = 1; ((size_t)1 << m) <= 2 * degree; ++m) {
+        size_t k = degree / ((size_t)1 << m) + 1;
+        best = min(best, (k - 1) + m + ((size_t)1 << (m - 1)) - 1);
+    }
+    return best;
+}
+
+} // namespace
+
+Ciphertext<DCRTPoly> evalOddPolynomial(const CryptoContext<DCRTPoly>& cc, const Ciphertext<DCRTPoly>& x, const vector<double>& c) {
+    // each coefficient multiplies the shallowest factor so no term is deeper than its power needs:
+    // c1 x at 1 level, (c3 x) x^2 at 2, (c5 x) x^4 and ((c7 x) x^2) x^4 at 3
+    const size_t degree = c.size() - 1;
+    auto x2 = countedSquare(cc, x);
+    auto result = cc->EvalMult(x, c[1]);
+    result = cc->EvalAdd(result, countedMult(cc, cc->EvalMult(x, c[3]), x2));
+    if (degree >= 5) {
+        auto x4 = countedSquare(cc, x2);
+        result = cc->EvalAdd(result, countedMult(cc, cc->EvalMult(x, c[5]), x4));
+        if (degree >= 7) {
+            auto t7 = countedMult(cc, cc->EvalMult(x, c[7]), x2);
+            result = cc->EvalAdd(result, countedMult(cc, t7, x4));
+        }
+    }
+    return result;
+}
+
+ComparisonKernel::ComparisonKernel(CryptoContext<DCRTPoly> cc, SignApproximation sign, ComparisonVariant variant)
+    : m_cc(move(cc)), m_sign(sign), m_variant(variant) {
+    if (levels(m_sign, m_variant) == 0) {
+        throw invalid_argument(m_variant == ComparisonVariant::Reference
+                                   ? "The reference comparison only implements the degree-3 sign without scaling"
+                                   : "The Chebyshev comparison needs a composite sign degree of at most 2031, got " +
+                                         to_string(compositeDegree(m_sign)));
+    }
+
+    // fold the input scale into the first iteration and polyMax's 1/2 into the last
+    auto base = signPolynomial(m_sign.degree);
+    for (size_t i = 0; i < m_sign.iterations; ++i) {
+        auto c = base;
+        for (size_t k = 0; k < c.size(); ++k) {
+            if (i == 0) c[k] *= pow(m_sign.inputScale, (double)k);
+            if (i + 1 == m_sign.iterations) c[k] *= 0.5;
+        }
+        m_stages.push_back(move(c));
+    }
+
+    if (m_variant == ComparisonVariant::Chebyshev) {
+        // the composite is itself a polynomial of degree degree^iterations, so a
+        // series of that degree reproduces it instead of approximating a new function
+        m_bound = 1.0 / m_sign.inputScale;
+        auto stages = m_stages;
+        auto composite = [stages](double x) {
+            for (const auto& c : stages) x = evalPolynomial(c, x);
+            return x;
+        };
+        m_chebyshev = EvalChebyshevCoefficients(composite, -m_bound, m_bound, (uint32_t)compositeDegree(m_sign));
+    }
+}
+
+Ciphertext<DCRTPoly> ComparisonKernel::max(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) const {
+    Metrics::add(Counter::PolyMax);
+    Ciphertext<DCRTPoly> result;
+    if (m_variant == ComparisonVariant::Reference) {
+        result = referenceMax(a, b);
+    } else {
+        auto diff = m_cc->EvalSub(a, b);
+        auto term1 = m_cc->EvalMult(m_cc->EvalAdd(a, b), 0.5);
+        auto term2 = countedMult(m_cc, halfSign(diff), diff);
+        result = m_cc->EvalAdd(term1, term2);
+    }
+    countLevelsConsumed(result, a, b);
+    return result;
+}
+
+Ciphertext<DCRTPoly> ComparisonKernel::halfSign(const Ciphertext<DCRTPoly>& x) const {
+    switch (m_variant) {
+        case ComparisonVariant::Reference: {
+            // simple polynomial approximation for sign function: sign(x) ~ 1.5x - 0.5x^3
+            auto x_cubed = countedMult(m_cc, countedMult(m_cc, x, x), x);
+            return m_cc->EvalAdd(m_cc->EvalMult(x, 1.5), m_cc->EvalMult(x_cubed, -0.5));
+        }
+        case ComparisonVariant::Chebyshev: {
+            // the series multiplies inside OpenFHE, out of reach of the call-site counters
+            const size_t products = chebyshevKeySwitches(compositeDegree(m_sign));
+            Metrics::add(Counter::EvalMultEstimated, products);
+            Metrics::add(Counter::KeySwitchEstimated, products);
+            return m_cc->EvalChebyshevSeries(x, m_chebyshev, -m_bound, m_bound);
+        }
+        case ComparisonVariant::Fused:
+        case ComparisonVariant::Lazy:
+            break;
+    }
+    Ciphertext<DCRTPoly> y = x;
+    for (const auto& stage : m_stages) {
+        y = m_variant == ComparisonVariant::Lazy ? evalOddPolynomialLazy(y, stage) : evalOddPolynomial(m_cc, y, stage);
+    }
+    return y;
+}
+
+Ciphertext<DCRTPoly> ComparisonKernel::evalOddPolynomialLazy(const Ciphertext<DCRTPoly>& x, const vector<double>& c) const {
+    // same terms as evalOddPolynomial, but the top-level products stay unrelinearized
+    // (three elements) until they are summed, so they share one key switch
+    const size_t degree = c.size() - 1;
+    auto x2 = countedSquare(m_cc, x);
+    auto sum = countedMultNoRelin(m_cc, m_cc->EvalMult(x, c[3]), x2);
+    if (degree >= 5) {
+        auto x4 = countedSquare(m_cc, x2);
+        sum = m_cc->EvalAdd(sum, countedMultNoRelin(m_cc, m_cc->EvalMult(x, c[5]), x4));
+        if (degree >= 7) {
+            auto t7 = countedMult(m_cc, m_cc->EvalMult(x, c[7]), x2);
+            sum = m_cc->EvalAdd(sum, countedMultNoRelin(m_cc, t7, x4));
+        }
+    }
+    sum = m_cc->EvalAdd(sum, m_cc->EvalMult(x, c[1]));
+    return countedRelinearize(m_cc, sum);
+}
+
+Ciphertext<DCRTPoly> ComparisonKernel::referenceMax(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) const {
+    auto diff = m_cc->EvalSub(a, b);
+    auto sign_of_diff = halfSign(diff);
+    auto term1 = m_cc->EvalAdd(a, b);
+    auto term2 = countedMult(m_cc, sign_of_diff, diff);
+    auto sum = m_cc->EvalAdd(term1, term2);
+    return m_cc->EvalMult(sum, 0.5);
+}
+
+uint32_t ComparisonKernel::levels(const SignApproximation& sign, ComparisonVariant variant) {
+    switch (variant) {
+        case ComparisonVariant::Reference:
+            // x^2, x^3, sign * diff; the constant multiplies add two more levels
+            return sign.degree == 3 && sign.iterations == 1 && sign.inputScale == 1.0 ? 5 : 0;
+        case ComparisonVariant::Fused:
+        case ComparisonVariant::Lazy:
+            return polyMaxDepth(sign);
+        case ComparisonVariant::Chebyshev: {
+            // the series, then the product with the difference
+            uint32_t depth = chebyshevDepth(compositeDegree(sign));
+            return depth == 0 ? 0 : depth + 1;
+        }
+    }
+    return 0;
+}
+
+ComparisonCost ComparisonKernel::cost() const {
+    ComparisonCost cost;
+    cost.levels = levels(m_sign, m_variant);
+    switch (m_variant) {
+        case ComparisonVariant::Reference:
+            cost.evalMults = 3;
+            cost.keySwitches = 3;
+            break;
+        case ComparisonVariant::Fused:
+            cost.evalMults = m_sign.iterations * signPolynomialMults(m_sign.degree) + 1;
+            cost.keySwitches = cost.evalMults;
+            break;
+        case ComparisonVariant::Lazy:
+            cost.evalMults = m_sign.iterations * signPolynomialMults(m_sign.degree) + 1;
+            cost.keySwitches = m_sign.iterations * lazyKeySwitches(m_sign.degree) + 1;
+            break;
+        case ComparisonVariant::Chebyshev:
+            cost.keySwitches = chebyshevKeySwitches(compositeDegree(m_sign)) + 1;
+            cost.evalMults = cost.keySwitches;
+            cost.keySwitchesExact = false;
+            break;
+    }
+    return cost;
+}
+
+const char* ComparisonKernel::name(ComparisonVariant variant) {
+    switch (variant) {
+        case ComparisonVariant::Reference: return "reference";
+        case ComparisonVariant::Fused: return "fused";
+        case ComparisonVariant::Lazy: return "lazy";
+        case ComparisonVariant::Chebyshev: return "chebyshev";
+    }
+    return "unknown";
+}
+
+ComparisonVariant ComparisonKernel::parse(const string& name) {
+    for (auto v : {ComparisonVariant::Reference, ComparisonVariant::Fused, ComparisonVariant::Lazy, ComparisonVariant::Chebyshev}) {
+        if (name == ComparisonKernel::name(v)) return v;
+    }
+    throw invalid_argument("Unknown comparison variant '" + name + "'");
+}
@@ -0,0 +1,68 @@
+#ifndef COMPARISON_KERNEL_H
+#define COMPARISON_KERNEL_H
+
+#include "openfhe.h"
+#include "ReductionPlanner.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How polyMax evaluates max(a, b) = (a + b)/2 + (a - b) * sign(a - b)/2.
+enum class ComparisonVariant {
+    Reference,  // the original kernel: x^3 by two chained EvalMults, unfused constants (degree 3 only)
+    Fused,      // EvalSquare, constants folded into the coefficients, eager relinearization
+    Lazy,       // Fused, but each polynomial sums EvalMultNoRelin terms and relinearizes once
+    Chebyshev,  // the whole composite sign as one Chebyshev series (Paterson-Stockmeyer in OpenFHE)
+};
+
+struct ComparisonCost {
+    uint32_t levels = 0;
+    size_t evalMults = 0;       // ciphertext-ciphertext products per comparison
+    size_t keySwitches = 0;     // relinearizations per comparison
+    bool keySwitchesExact = true;  // false when estimated from OpenFHE's evaluation strategy
+};
+
+// sum of c[k] x^k for an odd polynomial of degree 3, 5 or 7, by explicit products in
+// signPolynomialDepth(degree) levels (OpenFHE's EvalPoly takes 4 for degree 7)
+lbcrypto::Ciphertext<lbcrypto::DCRTPoly> evalOddPolynomial(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                           const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x,
+                                                           const std::vector<double>& c);
+
+// One comparison of the tournament. All variants approximate the same function for
+// a given SignApproximation (up to CKKS noise); they differ in depth and key switches.
+class ComparisonKernel {
+public:
+    ComparisonKernel(lbcrypto::CryptoContext<lbcrypto::DCRTPoly> cc, SignApproximation sign, ComparisonVariant variant);
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> max(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                                                 const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b) const;
+
+    // sign(x) / 2 (Reference: sign(x))
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> halfSign(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x) const;
+
+    ComparisonCost cost() const;
+
+    // levels of one comparison with this sign; 0 if the variant cannot evaluate it
+    static uint32_t levels(const SignApproximation& sign, ComparisonVariant variant);
+    ComparisonVariant variant() const { return m_variant; }
+    const SignApproximation& sign() const { return m_sign; }
+
+    static const char* name(ComparisonVariant variant);
+    static ComparisonVariant parse(const std::string& name);
+
+private:
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> evalOddPolynomialLazy(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x, const std::vector<double>& c) const;
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> referenceMax(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                                                          const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b) const;
+
+    lbcrypto::CryptoContext<lbcrypto::DCRTPoly> m_cc;
+    SignApproximation m_sign;
+    ComparisonVariant m_variant;
+    std::vector<std::vector<double>> m_stages;   // per iteration, with input scale and 1/2 folded in
+    std::vector<double> m_chebyshev;             // Chebyshev variant: series on [-m_bound, m_bound]
+    double m_bound = 1.0;
+};
+
+#endif // COMPARISON_KERNEL_H
@@ -0,0 +1,76 @@
+#ifndef COUNTED_EVAL_H
+#define COUNTED_EVAL_H
+
+#include "Metrics.h"
+#include "openfhe.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// The OpenFHE calls behind the EvalMult, EvalRotate and KeySwitch counters.
+// Each wrapper bumps its counters and forwards, so the metrics count the calls
+// the hot path actually made. Products with a scalar or plaintext neither key
+// switch nor count as EvalMult and are called directly.
+
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedMult(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                            const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                                                            const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b) {
+    Metrics::add(Counter::EvalMult);
+    Metrics::add(Counter::KeySwitch);
+    return cc->EvalMult(a, b);
+}
+
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedMultNoRelin(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                                   const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                                                                   const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b) {
+    Metrics::add(Counter::EvalMult);
+    return cc->EvalMultNoRelin(a, b);
+}
+
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedSquare(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                              const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x) {
+    Metrics::add(Counter::EvalMult);
+    Metrics::add(Counter::KeySwitch);
+    return cc->EvalSquare(x);
+}
+
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedRelinearize(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                                   const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct) {
+    Metrics::add(Counter::KeySwitch);
+    return cc->Relinearize(ct);
+}
+
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedRotate(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                                                              const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct,
+                                                              int32_t index) {
+    Metrics::add(Counter::EvalRotate);
+    Metrics::add(Counter::KeySwitch);
+    return cc->EvalRotate(ct, index);
+}
+
+// a hoisted rotation still key switches; only the decomposition of ct is shared
+inline lbcrypto::Ciphertext<lbcrypto::DCRTPoly> countedFastRotation(
+    const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc, const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct,
+    uint32_t index, uint32_t cyclotomicOrder, const std::shared_ptr<std::vector<lbcrypto::DCRTPoly>>& digits) {
+    Metrics::add(Counter::EvalRotate);
+    Metrics::add(Counter::KeySwitch);
+    return cc->EvalFastRotation(ct, index, cyclotomicOrder, digits);
+}
+
+// levels a ciphertext has consumed since encryption, pending rescale included
+inline uint32_t levelsConsumed(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct) {
+    return (uint32_t)(ct->GetLevel() + ct->GetNoiseScaleDeg() - 1);
+}
+
+// FLEXIBLEAUTO rescales inside the next operation, so there is no rescale call
+// to count; instead the levels an operation consumed are read off its output
+template <typename... Inputs>
+void countLevelsConsumed(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& out, const Inputs&... inputs) {
+    if (!Metrics::enabled()) return;
+    const uint32_t inputLevels = std::max({levelsConsumed(inputs)...});
+    const uint32_t outputLevels = levelsConsumed(out);
+    if (outputLevels > inputLevels) Metrics::add(Counter::LevelsConsumed, outputLevels - inputLevels);
+}
+
+#endif // COUNTED_EVAL_H
@@ -0,0 +1,74 @@
+#include "DotProductEngine.h"
+#include "CountedEval.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace lbcrypto;
+using namespace std;
+
+DotProductEngine::DotProductEngine(CryptoContext<DCRTPoly> cc, size_t blockStride, size_t radix, Plaintext blockMask)
+    : m_cc(move(cc)), m_blockStride(blockStride), m_radix(radix), m_blockMask(move(blockMask)) {
+    if (m_radix < 2 || (m_radix & (m_radix - 1)) != 0) {
+        throw invalid_argument("Rotation radix must be a power of two >= 2, got " + to_string(m_radix));
+    }
+    m_cyclotomicOrder = m_cc->GetCyclotomicOrder();
+
+    // rotations never need to cross the slot ring
+    size_t limit = min(m_blockStride, (size_t)m_cc->GetRingDimension() / 2);
+    for (size_t window = 1; window < limit; ) {
+        size_t fanIn = min(m_radix, (limit + window - 1) / window);
+        m_stages.push_back({window, fanIn});
+        window *= fanIn;
+    }
+}
+
+vector<int32_t> DotProductEngine::rotationIndices() const {
+    vector<int32_t> indices;
+    for (const auto& stage : m_stages) {
+        for (size_t k = 1; k < stage.fanIn; ++k) {
+            indices.push_back((int32_t)(k * stage.window));
+        }
+    }
+    return indices;
+}
+
+Ciphertext<DCRTPoly> DotProductEngine::dot(const Ciphertext<DCRTPoly>& query, const Ciphertext<DCRTPoly>& record) const {
+    // element-wise multiplication
+    auto sum = blockSum(countedMult(m_cc, query, record));
+    if (m_blockMask) {
+        // keep only the block-start slots, which hold one similarity per template
+        sum = m_cc->EvalMult(sum, m_blockMask);
+    }
+    countLevelsConsumed(sum, query, record);
+    return sum;
+}
+
+Ciphertext<DCRTPoly> DotProductEngine::blockSum(const Ciphertext<DCRTPoly>& ct) const {
+    Ciphertext<DCRTPoly> sum = ct;
+    for (const auto& stage : m_stages) {
+        if (stage.fanIn == 2) {
+            // a single rotation gains nothing from hoisting
+            sum = m_cc->EvalAdd(sum, countedRotate(m_cc, sum, (int32_t)stage.window));
+            continue;
+        }
+        auto digits = m_cc->EvalFastRotationPrecompute(sum);
+        Ciphertext<DCRTPoly> acc = sum;
+        for (size_t k = 1; k < stage.fanIn; ++k) {
+            auto rotated = countedFastRotation(m_cc, sum, (uint32_t)(k * stage.window), m_cyclotomicOrder, digits);
+            acc = m_cc->EvalAdd(acc, rotated);
+        }
+        sum = acc;
+    }
+    return sum;
+}
+
+size_t DotProductEngine::rotationsPerDot() const {
+    size_t n = 0;
+    for (const auto& stage : m_stages) n += stage.fanIn - 1;
+    return n;
+}
+
+size_t DotProductEngine::keySwitchDecompositionsPerDot() const {
+    return m_stages.size();
+}
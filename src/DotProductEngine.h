@@ -0,0 +1,50 @@
+#ifndef DOT_PRODUCT_ENGINE_H
+#define DOT_PRODUCT_ENGINE_H
+
+#include "openfhe.h"
+#include <cstddef>
+#include <vector>
+
+// Computes block-local encrypted dot products: multiplies a query with a
+// gallery ciphertext, sums every blockStride-slot block into its first slot
+// and, given a block mask, keeps only those first slots.
+//
+// The slot sum is done in stages of `radix` rotations. Radix 2 is the classic
+// serial rotate-and-add chain (one full key switch per doubling). A larger
+// radix hoists the key-switch decomposition: each stage decomposes its input
+// once with EvalFastRotationPrecompute and then produces radix-1 rotations
+// with EvalFastRotation, trading full rotations for cheaper hoisted ones at
+// the cost of radix-2 extra rotation keys per stage.
+class DotProductEngine {
+public:
+    DotProductEngine(lbcrypto::CryptoContext<lbcrypto::DCRTPoly> cc, size_t blockStride, size_t radix,
+                     lbcrypto::Plaintext blockMask = nullptr);
+
+    // rotation indices the engine will ask for; generateThresholdKeys must create exactly these
+    std::vector<int32_t> rotationIndices() const;
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> dot(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& query,
+                                                 const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& record) const;
+
+    // block-local sum on its own, exposed for benchmarking the rotation schedule
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> blockSum(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct) const;
+
+    size_t rotationsPerDot() const;
+    size_t keySwitchDecompositionsPerDot() const;
+    size_t radix() const { return m_radix; }
+
+private:
+    struct Stage {
+        size_t window;   // slots already summed when the stage starts
+        size_t fanIn;    // rotations of the stage input summed together (incl. the identity)
+    };
+
+    lbcrypto::CryptoContext<lbcrypto::DCRTPoly> m_cc;
+    size_t m_blockStride;
+    size_t m_radix;
+    uint32_t m_cyclotomicOrder;
+    std::vector<Stage> m_stages;
+    lbcrypto::Plaintext m_blockMask;
+};
+
+#endif // DOT_PRODUCT_ENGINE_H
@@ -0,0 +1,25 @@
+#include "GalleryCache.h"
+#include "GalleryFile.h"
+
+using namespace lbcrypto;
+using namespace std;
+
+GalleryCache::GalleryCache(const GalleryReader& gallery, uint64_t budgetBytes, size_t first) : m_first(first) {
+    for (size_t i = first; i < gallery.recordCount(); ++i) {
+        // the stored size is the compressed one with --compress-gallery, so the budget
+        // counts the RNS limbs the deserialized ciphertext actually holds
+        auto ct = gallery.loadRecord(i);
+        uint64_t size = residentSize(ct);
+        if (m_bytes + size > budgetBytes) break;
+        m_records.push_back(move(ct));
+        m_bytes += size;
+    }
+}
+
+uint64_t GalleryCache::residentSize(const Ciphertext<DCRTPoly>& ct) {
+    uint64_t words = 0;
+    for (const auto& element : ct->GetElements()) {
+        words += (uint64_t)element.GetNumOfElements() * element.GetRingDimension();
+    }
+    return words * sizeof(uint64_t);
+}
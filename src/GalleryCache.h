@@ -0,0 +1,39 @@
+#ifndef GALLERY_CACHE_H
+#define GALLERY_CACHE_H
+
+#include "openfhe.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class GalleryReader;
+
+// Deserialized gallery records kept resident by a long-lived process.
+//
+// Every query walks the gallery in record order, so an LRU would evict each
+// record just before it is needed again. The cache instead pins the longest
+// run of records from `first` that fits the byte budget; the rest is
+// deserialized from the file mapping on every pass. A shard worker starts the
+// run at its own shard.
+class GalleryCache {
+public:
+    GalleryCache(const GalleryReader& gallery, uint64_t budgetBytes, size_t first = 0);
+
+    // nullptr when the record is not resident
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> get(size_t index) const {
+        return index >= m_first && index - m_first < m_records.size() ? m_records[index - m_first] : nullptr;
+    }
+
+    size_t residentRecords() const { return m_records.size(); }
+    uint64_t residentBytes() const { return m_bytes; }
+
+    // bytes of RNS limbs a ciphertext holds in memory: towers at its level times ring dimension
+    static uint64_t residentSize(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct);
+
+private:
+    size_t m_first;
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> m_records;
+    uint64_t m_bytes = 0;
+};
+
+#endif // GALLERY_CACHE_H
@@ -0,0 +1,382 @@
+#include "GalleryFile.h"
+#include "Metrics.h"
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <spanstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "ciphertext-ser.h"
+#include "cryptocontext-ser.h"
+#include "scheme/ckksrns/ckksrns-ser.h"
+
+#ifdef BIOMETRIC_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+constexpr char kMagic[8] = {'B', 'I', 'O', 'G', 'A', 'L', 'R', 'Y'};
+constexpr uint32_t kVersion = 3;
+#ifdef BIOMETRIC_WITH_ZSTD
+constexpr int kZstdLevel = 3;
+#endif
+
+// slicing-by-8 tables for the reflected IEEE polynomial
+constexpr array<array<uint32_t, 256>, 8> makeCrcTables() {
+    array<array<uint32_t, 256>, 8> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+    return t;
+}
+constexpr auto kCrcTables = makeCrcTables();
+
+class Fnv1a {
+public:
+    void add(uint64_t v) {
+        for (int i = 0; i < 8; ++i) {
+            m_hash ^= (v >> (8 * i)) & 0xFF;
+            m_hash *= 0x100000001b3ull;
+        }
+    }
+    uint64_t value() const { return m_hash; }
+
+private:
+    uint64_t m_hash = 0xcbf29ce484222325ull;
+};
+
+} // namespace
+
+bool compressionAvailable(GalleryCompression compression) {
+    switch (compression) {
+    case GalleryCompression::None:
+        return true;
+    case GalleryCompression::Zstd:
+#ifdef BIOMETRIC_WITH_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+uint64_t cryptoFingerprint(const CryptoContext<DCRTPoly>& cc) {
+    auto params = dynamic_pointer_cast<CryptoParametersRNS<DCRTPoly>>(cc->GetCryptoParameters());
+    if (!params) throw runtime_error("Gallery files require an RNS crypto context");
+
+    Fnv1a h;
+    h.add(cc->GetRingDimension());
+    h.add(cc->GetEncodingParams()->GetBatchSize());
+    h.add(params->GetScalingTechnique());
+    h.add(params->GetKeySwitchTechnique());
+    for (const auto& tower : params->GetElementParams()->GetParams()) {
+        h.add(tower->GetModulus().ConvertToInt());
+    }
+    return h.value();
+}
+
+namespace {
+
+uint32_t recordCrc32(const char* data, size_t length, uint32_t crc = 0) {
+    const auto* p = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+    while (length >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = kCrcTables[7][lo & 0xFF] ^ kCrcTables[6][(lo >> 8) & 0xFF] ^
+              kCrcTables[5][(lo >> 16) & 0xFF] ^ kCrcTables[4][lo >> 24] ^
+              kCrcTables[3][hi & 0xFF] ^ kCrcTables[2][(hi >> 8) & 0xFF] ^
+              kCrcTables[1][(hi >> 16) & 0xFF] ^ kCrcTables[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) crc = kCrcTables[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+} // namespace
+
+GalleryWriter::GalleryWriter(const string& path, const CryptoContext<DCRTPoly>& cc,
+                             size_t vecDim, size_t blockStride, size_t templatesPerRecord, uint32_t droppedLevels,
+                             GalleryCompression compression)
+    : m_path(path), m_writePath(path + ".tmp") {
+    if (!compressionAvailable(compression)) {
+        throw runtime_error("Gallery compression is not available in this build (configure with -DBIOMETRIC_WITH_ZSTD=ON)");
+    }
+    m_file.open(m_writePath, ios::binary | ios::in | ios::out | ios::trunc);
+    if (!m_file) throw runtime_error("Failed to create file: " + m_writePath);
+
+    memset(&m_header, 0, sizeof(m_header));
+    m_header.version = kVersion;
+    m_header.headerSize = sizeof(GalleryHeader);
+    m_header.paramFingerprint = cryptoFingerprint(cc);
+    m_header.vecDim = (uint32_t)vecDim;
+    m_header.blockStride = (uint32_t)blockStride;
+    m_header.templatesPerRecord = (uint32_t)templatesPerRecord;
+    m_header.compression = (uint32_t)compression;
+    m_header.droppedLevels = droppedLevels;
+
+    // magic stays zeroed until close(), so an interrupted write is never mistaken for a gallery
+    m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+    m_position = sizeof(m_header);
+}
+
+GalleryWriter::GalleryWriter(const string& path, const CryptoContext<DCRTPoly>& cc) : m_path(path), m_writePath(path) {
+    {
+        GalleryReader existing(path, cc);
+        m_header = existing.header();
+        m_offsets.resize(m_header.recordCount);
+        for (size_t i = 0; i < m_offsets.size(); ++i) m_offsets[i] = existing.recordOffset(i);
+        m_ids.resize(m_header.recordCount * m_header.templatesPerRecord);
+        memcpy(m_ids.data(), existing.m_ids, m_ids.size() * sizeof(uint64_t));
+    }
+
+    // new records go after the old id table; the header keeps pointing at the
+    // old index and id table until close(). This also overwrites whatever an
+    // interrupted append left past the end.
+    m_appendStart = m_header.idTableOffset + m_ids.size() * sizeof(uint64_t);
+    m_file.open(path, ios::binary | ios::in | ios::out);
+    if (!m_file) throw runtime_error("Failed to open gallery for appending: " + path);
+    m_position = m_appendStart;
+    m_file.seekp((streamoff)m_position);
+    if (!m_file) throw runtime_error("Failed to open gallery for appending: " + path);
+}
+
+GalleryWriter::~GalleryWriter() {
+    if (m_closed) return;
+    m_file.close();
+    error_code ignored;
+    if (m_appendStart == 0) {
+        filesystem::remove(m_writePath, ignored);
+    } else {
+        filesystem::resize_file(m_writePath, m_appendStart, ignored);
+    }
+}
+
+void GalleryWriter::append(const Ciphertext<DCRTPoly>& ct, span<const uint64_t> ids) {
+    ostringstream oss(ios::binary);
+    Serial::Serialize(ct, oss, SerType::BINARY);
+    auto bytes = oss.view();
+    appendSerialized(span<const char>(bytes.data(), bytes.size()), ids);
+}
+
+void GalleryWriter::appendSerialized(span<const char> bytes, span<const uint64_t> ids) {
+    if (m_header.compression == (uint32_t)GalleryCompression::None) {
+        appendStored(bytes, ids);
+        return;
+    }
+    auto stored = encodeRecord(string(bytes.begin(), bytes.end()));
+    appendStored(stored, ids);
+}
+
+string GalleryWriter::encodeRecord(string serialized) const {
+#ifdef BIOMETRIC_WITH_ZSTD
+    if (m_header.compression == (uint32_t)GalleryCompression::Zstd) {
+        string stored(ZSTD_compressBound(serialized.size()), '\0');
+        size_t size = ZSTD_compress(stored.data(), stored.size(), serialized.data(), serialized.size(), kZstdLevel);
+        if (ZSTD_isError(size)) throw runtime_error(string("zstd compression failed: ") + ZSTD_getErrorName(size));
+        stored.resize(size);
+        return stored;
+    }
+#endif
+    return serialized;
+}
+
+void GalleryWriter::appendStored(span<const char> bytes, span<const uint64_t> ids) {
+    if (m_closed) throw logic_error("Cannot append to a closed gallery: " + m_path);
+    if (ids.size() != m_header.templatesPerRecord) {
+        throw invalid_argument("Record " + to_string(m_offsets.size()) + " has " + to_string(ids.size()) +
+                               " block ids, the gallery stores " + to_string(m_header.templatesPerRecord));
+    }
+
+    RecordFrame frame{bytes.size(), recordCrc32(bytes.data(), bytes.size()), 0};
+    m_file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+    m_file.write(bytes.data(), bytes.size());
+    if (!m_file.good()) {
+        throw runtime_error("Serialization failed for record " + to_string(m_offsets.size()));
+    }
+    m_offsets.push_back(m_position);
+    m_position += sizeof(frame) + bytes.size();
+    for (uint64_t id : ids) {
+        if (isLiveTemplate(id)) ++m_header.numTemplates;
+    }
+    m_ids.insert(m_ids.end(), ids.begin(), ids.end());
+}
+
+void GalleryWriter::close() {
+    if (m_closed) return;
+    m_header.recordCount = m_offsets.size();
+    m_header.indexOffset = m_position;
+    m_file.write(reinterpret_cast<const char*>(m_offsets.data()), m_offsets.size() * sizeof(uint64_t));
+    m_position += m_offsets.size() * sizeof(uint64_t);
+    m_header.idTableOffset = m_position;
+    m_file.write(reinterpret_cast<const char*>(m_ids.data()), m_ids.size() * sizeof(uint64_t));
+    m_position += m_ids.size() * sizeof(uint64_t);
+
+    // the index and id table reach the file before the header that points at them
+    m_file.flush();
+    memcpy(m_header.magic, kMagic, sizeof(kMagic));
+    m_file.seekp(0);
+    m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+    m_file.close();
+    if (m_file.fail()) throw runtime_error("Failed to finalize gallery file: " + m_writePath);
+    if (m_writePath != m_path) filesystem::rename(m_writePath, m_path);
+    m_closed = true;
+    // an interrupted earlier append can leave bytes past the new end
+    if (filesystem::file_size(m_path) > m_position) filesystem::resize_file(m_path, m_position);
+}
+
+GalleryReader::GalleryReader(const string& path, const CryptoContext<DCRTPoly>& cc) : m_file(path) {
+    if (m_file.size() < sizeof(GalleryHeader)) {
+        throw runtime_error("Not a gallery file (too short): " + path);
+    }
+    memcpy(&m_header, m_file.data(), sizeof(m_header));
+    if (memcmp(m_header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw runtime_error("Not a gallery file (bad magic, or the write was interrupted): " + path);
+    }
+    if (m_header.version != kVersion || m_header.headerSize != sizeof(GalleryHeader)) {
+        throw runtime_error("Unsupported gallery format version " + to_string(m_header.version) + ": " + path);
+    }
+    if (!compressionAvailable((GalleryCompression)m_header.compression)) {
+        throw runtime_error("Gallery " + path + " uses record compression " + to_string(m_header.compression) +
+                            ", which this build cannot read");
+    }
+    if (m_header.paramFingerprint != cryptoFingerprint(cc)) {
+        throw runtime_error("Gallery " + path + " was encrypted under different CKKS parameters "
+                            "than the current crypto context");
+    }
+    if (m_header.indexOffset > m_file.size() ||
+        m_header.recordCount > (m_file.size() - m_header.indexOffset) / sizeof(uint64_t)) {
+        throw runtime_error("Gallery index is out of bounds: " + path);
+    }
+    if (m_header.templatesPerRecord == 0 ||
+        m_header.idTableOffset != m_header.indexOffset + m_header.recordCount * sizeof(uint64_t) ||
+        m_header.recordCount * m_header.templatesPerRecord > (m_file.size() - m_header.idTableOffset) / sizeof(uint64_t)) {
+        throw runtime_error("Gallery id table is out of bounds: " + path);
+    }
+    m_index = m_file.data() + m_header.indexOffset;
+    m_ids = m_file.data() + m_header.idTableOffset;
+}
+
+uint64_t GalleryReader::recordOffset(size_t index) const {
+    uint64_t offset;
+    memcpy(&offset, m_index + index * sizeof(uint64_t), sizeof(offset));
+    return offset;
+}
+
+span<const char> GalleryReader::record(size_t index) const {
+    if (index >= m_header.recordCount) {
+        throw out_of_range("Gallery record " + to_string(index) + " out of range");
+    }
+    uint64_t offset = recordOffset(index);
+    RecordFrame frame;
+    if (offset < sizeof(GalleryHeader) || offset > m_header.indexOffset ||
+        m_header.indexOffset - offset < sizeof(frame)) {
+        throw runtime_error("Corrupt gallery index entry " + to_string(index) + ": " + m_file.path());
+    }
+    memcpy(&frame, m_file.data() + offset, sizeof(frame));
+    if (frame.length > m_header.indexOffset - offset - sizeof(frame)) {
+        throw runtime_error("Corrupt gallery record length " + to_string(index) + ": " + m_file.path());
+    }
+    const char* payload = m_file.data() + offset + sizeof(frame);
+    if (recordCrc32(payload, frame.length) != frame.crc32) {
+        throw runtime_error("Checksum mismatch in gallery record " + to_string(index) + ": " + m_file.path());
+    }
+    return {payload, frame.length};
+}
+
+Ciphertext<DCRTPoly> GalleryReader::loadRecord(size_t index) const {
+    StageTimer timer(Stage::Deserialize);
+    auto bytes = record(index);
+    Metrics::add(Counter::RecordsRead);
+    Metrics::add(Counter::BytesRead, bytes.size());
+#ifdef BIOMETRIC_WITH_ZSTD
+    // one buffer per reader thread, reused across records of the same size
+    thread_local string decompressed;
+    if (m_header.compression == (uint32_t)GalleryCompression::Zstd) {
+        auto size = ZSTD_getFrameContentSize(bytes.data(), bytes.size());
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            throw runtime_error("Corrupt compressed gallery record " + to_string(index) + ": " + m_file.path());
+        }
+        decompressed.resize(size);
+        size_t got = ZSTD_decompress(decompressed.data(), decompressed.size(), bytes.data(), bytes.size());
+        if (ZSTD_isError(got) || got != size) {
+            throw runtime_error("Failed to decompress gallery record " + to_string(index) + ": " + m_file.path());
+        }
+        bytes = span<const char>(decompressed.data(), decompressed.size());
+    }
+#endif
+    ispanstream is(bytes);
+    Ciphertext<DCRTPoly> ct;
+    Serial::Deserialize(ct, is, SerType::BINARY);
+    if (is.fail() || !ct) {
+        throw runtime_error("Failed to deserialize gallery record " + to_string(index) + ": " + m_file.path());
+    }
+    return ct;
+}
+
+uint64_t GalleryReader::templateId(size_t index, size_t block) const {
+    if (index >= m_header.recordCount || block >= m_header.templatesPerRecord) {
+        throw out_of_range("Gallery block " + to_string(index) + "/" + to_string(block) + " out of range");
+    }
+    uint64_t id;
+    memcpy(&id, m_ids + (index * m_header.templatesPerRecord + block) * sizeof(uint64_t), sizeof(id));
+    return id;
+}
+
+vector<bool> GalleryReader::liveBlocks(size_t index) const {
+    vector<bool> live(m_header.templatesPerRecord);
+    for (size_t b = 0; b < live.size(); ++b) live[b] = isLiveTemplate(templateId(index, b));
+    return live;
+}
+
+void GalleryReader::prefetch(size_t index) const {
+    if (index >= m_header.recordCount) return;
+    uint64_t offset = recordOffset(index);
+    uint64_t next = index + 1 < m_header.recordCount ? recordOffset(index + 1) : m_header.indexOffset;
+    if (offset < next) m_file.prefetch(offset, next - offset);
+}
+
+size_t tombstoneTemplates(const string& path, const CryptoContext<DCRTPoly>& cc, const vector<uint64_t>& ids) {
+    unordered_set<uint64_t> wanted(ids.begin(), ids.end());
+    vector<pair<uint64_t, uint64_t>> updates;   // table position, new entry
+    GalleryHeader header;
+    {
+        GalleryReader gallery(path, cc);
+        header = gallery.header();
+        for (size_t r = 0; r < gallery.recordCount(); ++r) {
+            for (size_t b = 0; b < header.templatesPerRecord; ++b) {
+                uint64_t id = gallery.templateId(r, b);
+                if (isLiveTemplate(id) && wanted.contains(id)) {
+                    updates.emplace_back(r * header.templatesPerRecord + b, id | kDeletedTemplate);
+                }
+            }
+        }
+    }
+    if (updates.empty()) return 0;
+
+    fstream file(path, ios::binary | ios::in | ios::out);
+    for (const auto& [position, entry] : updates) {
+        file.seekp((streamoff)(header.idTableOffset + position * sizeof(uint64_t)));
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    }
+    header.numTemplates -= updates.size();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!file) throw runtime_error("Failed to mark templates deleted in " + path);
+    return updates.size();
+}
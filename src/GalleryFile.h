@@ -0,0 +1,172 @@
+#ifndef GALLERY_FILE_H
+#define GALLERY_FILE_H
+
+#include "openfhe.h"
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+// On-disk encrypted gallery.
+//
+//   [GalleryHeader]
+//   [RecordFrame][serialized ciphertext] ... one per record
+//   [uint64 offset of each RecordFrame]   <- header.indexOffset
+//   [uint64 template id of each block]    <- header.idTableOffset, templatesPerRecord per record
+//
+// The header pins the crypto parameters and the slot layout the records were
+// written with; the trailing index gives O(1) access to any record range, and
+// each record carries its length and CRC-32. Blocks that hold no enrolled
+// template (padding, or a copy left by compaction) have id kPaddingTemplate;
+// deleted templates keep their id with kDeletedTemplate set until compaction.
+// Records may be stored up to `droppedLevels` below a fresh encryption and, with
+// `compression` set, as one compressed frame each; the length and CRC cover the
+// stored bytes. An append
+// writes its records, index and id table after the old id table and only then
+// rewrites the header, so the index and id table of the previous version stay
+// behind as unreferenced bytes until the gallery is compacted.
+struct GalleryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t paramFingerprint;
+    uint32_t vecDim;
+    uint32_t blockStride;
+    uint32_t templatesPerRecord;
+    uint32_t compression;       // GalleryCompression of every record
+    uint64_t numTemplates;
+    uint64_t recordCount;
+    uint64_t indexOffset;
+    uint64_t idTableOffset;
+    uint32_t droppedLevels;     // levels the lowest record is below a fresh encryption
+    uint32_t reserved;
+};
+static_assert(sizeof(GalleryHeader) == 80, "GalleryHeader is part of the file format");
+
+constexpr uint64_t kPaddingTemplate = UINT64_MAX;
+constexpr uint64_t kDeletedTemplate = 1ull << 63;
+
+// an enrolled template that has not been deleted
+inline bool isLiveTemplate(uint64_t id) { return (id & kDeletedTemplate) == 0; }
+
+// CKKS coefficients are close to uniform modulo each tower, so compression
+// mostly recovers the unused high bits of each 64-bit word.
+enum class GalleryCompression : uint32_t {
+    None = 0,
+    Zstd = 1,   // needs a build with BIOMETRIC_WITH_ZSTD
+};
+
+// false for codecs this build cannot read or write
+bool compressionAvailable(GalleryCompression compression);
+
+struct RecordFrame {
+    uint64_t length;
+    uint32_t crc32;
+    uint32_t reserved;
+};
+static_assert(sizeof(RecordFrame) == 16, "RecordFrame is part of the file format");
+
+// Hash of everything a ciphertext needs to be evaluated against this context:
+// ring dimension, slot count, modulus chain and scaling/key-switch technique.
+uint64_t cryptoFingerprint(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc);
+
+class GalleryWriter {
+public:
+    // creates (or replaces) a gallery; records go to a temporary file that
+    // close() renames over path, so an existing gallery stays intact until then
+    GalleryWriter(const std::string& path, const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                  size_t vecDim, size_t blockStride, size_t templatesPerRecord, uint32_t droppedLevels = 0,
+                  GalleryCompression compression = GalleryCompression::None);
+
+    // reopens an existing gallery to append records after the existing ones,
+    // which are neither read nor rewritten; readers see the old gallery until close()
+    GalleryWriter(const std::string& path, const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc);
+
+    // without close(), removes the temporary file or cuts off the appended records
+    ~GalleryWriter();
+
+    GalleryWriter(const GalleryWriter&) = delete;
+    GalleryWriter& operator=(const GalleryWriter&) = delete;
+
+    // ids holds one entry per block (templatesPerRecord), kPaddingTemplate for unused blocks
+    void append(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct, std::span<const uint64_t> ids);
+    void appendSerialized(std::span<const char> bytes, std::span<const uint64_t> ids);
+
+    // a record exactly as GalleryReader::record returns it from a gallery with the same compression
+    void appendStored(std::span<const char> stored, std::span<const uint64_t> ids);
+
+    // stored form of a serialized ciphertext, for appendStored; safe to call from other threads
+    std::string encodeRecord(std::string serialized) const;
+
+    // writes the index, the id table and then the header that makes them current
+    void close();
+
+    const GalleryHeader& header() const { return m_header; }
+    size_t templatesPerRecord() const { return m_header.templatesPerRecord; }
+    size_t recordCount() const { return m_offsets.size(); }
+    uint64_t bytesWritten() const { return m_position; }
+
+    // block ids of every record so far, including those of an appended-to gallery
+    const std::vector<uint64_t>& templateIds() const { return m_ids; }
+
+private:
+    std::string m_path;
+    std::string m_writePath;    // m_path, or the temporary file of a new gallery
+    uint64_t m_appendStart = 0; // end of the gallery appended to; 0 for a new gallery
+    std::fstream m_file;
+    GalleryHeader m_header;
+    std::vector<uint64_t> m_offsets;
+    std::vector<uint64_t> m_ids;
+    uint64_t m_position;
+    bool m_closed = false;
+};
+
+// Memory-mapped read-only view of a gallery file. Opening validates the header,
+// the crypto fingerprint and the index bounds without touching the records;
+// records are checksummed when accessed.
+class GalleryReader {
+public:
+    GalleryReader(const std::string& path, const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc);
+    ~GalleryReader();
+
+    GalleryReader(const GalleryReader&) = delete;
+    GalleryReader& operator=(const GalleryReader&) = delete;
+
+    const GalleryHeader& header() const { return m_header; }
+    size_t recordCount() const { return m_header.recordCount; }
+    uint64_t fileSize() const { return m_file.size(); }
+
+    // zero-copy view of the stored record (compressed if the gallery is), checksum verified
+    std::span<const char> record(size_t index) const;
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> loadRecord(size_t index) const;
+
+    // id of the template in block `block` of record `index`
+    uint64_t templateId(size_t index, size_t block) const;
+
+    // true for blocks holding an enrolled, undeleted template
+    std::vector<bool> liveBlocks(size_t index) const;
+
+    // hint the kernel to start reading a record that will be needed soon
+    void prefetch(size_t index) const;
+
+private:
+    friend class GalleryWriter;
+
+    uint64_t recordOffset(size_t index) const;
+
+    MappedFile m_file;
+    GalleryHeader m_header;
+    const char* m_index = nullptr;
+    const char* m_ids = nullptr;
+};
+
+// marks the given template ids deleted in place; they keep matching until the
+// gallery is compacted. Returns how many were found.
+size_t tombstoneTemplates(const std::string& path, const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                          const std::vector<uint64_t>& ids);
+
+#endif // GALLERY_FILE_H
@@ -0,0 +1,213 @@
+#include "KeyStore.h"
+#include "GalleryFile.h"
+#include "MappedFile.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <spanstream>
+#include <stdexcept>
+
+#include "ciphertext-ser.h"
+#include "cryptocontext-ser.h"
+#include "key/key-ser.h"
+#include "scheme/ckksrns/ckksrns-ser.h"
+
+using namespace lbcrypto;
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* kManifest = "manifest.txt";
+const char* kContext = "cryptocontext.bin";
+const char* kPublicKey = "public.key";
+const char* kEvalMult = "eval-mult.key";
+const char* kEvalRotate = "eval-rotate.key";
+const char* kSimulationKey = "simulation-secret.key";
+
+template <typename T>
+void writeObject(const string& file, const T& obj) {
+    if (!Serial::SerializeToFile(file, obj, SerType::BINARY)) {
+        throw runtime_error("Failed to write " + file);
+    }
+}
+
+template <typename T>
+T readObject(const string& file) {
+    MappedFile mapped(file);
+    ispanstream is(mapped.bytes());
+    T obj;
+    Serial::Deserialize(obj, is, SerType::BINARY);
+    if (is.fail() || !obj) throw runtime_error("Failed to read " + file);
+    return obj;
+}
+
+} // namespace
+
+KeyStore::KeyStore(string directory) : m_directory(move(directory)) {}
+
+string KeyStore::path(const string& name) const {
+    return path(m_directory, name);
+}
+
+string KeyStore::path(const string& directory, const string& name) {
+    return (fs::path(directory) / name).string();
+}
+
+bool KeyStore::exists() const {
+    return fs::exists(path(kManifest));
+}
+
+void KeyStore::save(const CryptoContext<DCRTPoly>& cc, const PublicKey<DCRTPoly>& publicKey,
+                    const PrivateKey<DCRTPoly>& simulationSecretKey, const vector<PrivateKey<DCRTPoly>>& shares,
+                    const KeyStoreManifest& manifest) const {
+    // "keys/" must stage next to the directory, not inside it
+    fs::path directory(m_directory);
+    if (!directory.has_filename()) directory = directory.parent_path();
+    // a leftover from an interrupted save holds nothing worth keeping
+    const string staging = directory.string() + ".tmp";
+    fs::remove_all(staging);
+    fs::create_directories(staging);
+
+    writeObject(path(staging, kContext), cc);
+    writeObject(path(staging, kPublicKey), publicKey);
+    writeObject(path(staging, kSimulationKey), simulationSecretKey);
+    for (size_t i = 0; i < shares.size(); ++i) {
+        writeObject(path(staging, "share-" + to_string(i + 1) + ".key"), shares[i]);
+    }
+
+    {
+        ofstream ofs(path(staging, kEvalMult), ios::binary);
+        if (!ofs || !cc->SerializeEvalMultKey(ofs, SerType::BINARY)) {
+            throw runtime_error("Failed to write " + path(staging, kEvalMult));
+        }
+    }
+    {
+        ofstream ofs(path(staging, kEvalRotate), ios::binary);
+        if (!ofs || !cc->SerializeEvalAutomorphismKey(ofs, SerType::BINARY)) {
+            throw runtime_error("Failed to write " + path(staging, kEvalRotate));
+        }
+    }
+
+    // the manifest goes last: its presence marks the store as complete
+    {
+        ofstream ofs(path(staging, kManifest));
+        ofs << "multDepth=" << manifest.multDepth << "\n"
+            << "vecDim=" << manifest.vecDim << "\n"
+            << "batchSize=" << manifest.batchSize << "\n"
+            << "packGallery=" << (manifest.packGallery ? 1 : 0) << "\n"
+            << "rotationRadix=" << manifest.rotationRadix << "\n"
+            << "numParties=" << manifest.numParties << "\n"
+            << "ringDim=" << manifest.ringDim << "\n"
+            << "fingerprint=" << manifest.fingerprint << "\n"
+            << "signDegree=" << manifest.signDegree << "\n"
+            << "signIterations=" << manifest.signIterations << "\n"
+            << "signInputScale=" << setprecision(17) << manifest.signInputScale << "\n"
+            << "bootstrap=" << (manifest.bootstrap ? 1 : 0) << "\n"
+            << "bootstrapLevelBudget=" << manifest.bootstrapLevelBudget << "\n";
+        if (!ofs.good()) throw runtime_error("Failed to write " + path(staging, kManifest));
+    }
+
+    // a directory cannot be renamed over a non-empty one, so the old store is first
+    // marked incomplete by removing its manifest, then moved aside and deleted
+    if (fs::exists(m_directory)) {
+        const string retired = directory.string() + ".old";
+        fs::remove(path(kManifest));
+        fs::remove_all(retired);
+        fs::rename(directory, retired);
+        fs::rename(staging, directory);
+        fs::remove_all(retired);
+    } else {
+        fs::rename(staging, directory);
+    }
+}
+
+KeyStoreManifest KeyStore::loadManifest() const {
+    ifstream ifs(path(kManifest));
+    if (!ifs) throw runtime_error("No key store at " + m_directory + " (run with --init-keys first)");
+
+    map<string, string> fields;
+    string line;
+    while (getline(ifs, line)) {
+        auto eq = line.find('=');
+        if (eq != string::npos) fields[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+    auto field = [&](const string& key) -> const string& {
+        auto it = fields.find(key);
+        if (it == fields.end()) throw runtime_error("Key store manifest is missing '" + key + "'");
+        return it->second;
+    };
+
+    KeyStoreManifest m;
+    m.multDepth = (uint32_t)stoul(field("multDepth"));
+    m.vecDim = stoul(field("vecDim"));
+    m.batchSize = stoul(field("batchSize"));
+    m.packGallery = field("packGallery") == "1";
+    m.rotationRadix = stoul(field("rotationRadix"));
+    m.numParties = stoi(field("numParties"));
+    m.ringDim = (uint32_t)stoul(field("ringDim"));
+    m.fingerprint = stoull(field("fingerprint"));
+    if (fields.count("signDegree")) {
+        m.signDegree = stoul(field("signDegree"));
+        m.signIterations = stoul(field("signIterations"));
+        m.signInputScale = stod(field("signInputScale"));
+    }
+    if (fields.count("bootstrap")) {
+        m.bootstrap = field("bootstrap") == "1";
+        m.bootstrapLevelBudget = (uint32_t)stoul(field("bootstrapLevelBudget"));
+    }
+    return m;
+}
+
+CryptoContext<DCRTPoly> KeyStore::loadContext() const {
+    CryptoContextImpl<DCRTPoly>::ClearEvalMultKeys();
+    CryptoContextImpl<DCRTPoly>::ClearEvalAutomorphismKeys();
+    CryptoContextFactory<DCRTPoly>::ReleaseAllContexts();
+
+    auto cc = readObject<CryptoContext<DCRTPoly>>(path(kContext));
+    if (cryptoFingerprint(cc) != loadManifest().fingerprint) {
+        throw runtime_error("Key store " + m_directory + " is inconsistent: context does not match its manifest");
+    }
+    return cc;
+}
+
+PublicKey<DCRTPoly> KeyStore::loadPublicKey() const {
+    return readObject<PublicKey<DCRTPoly>>(path(kPublicKey));
+}
+
+PrivateKey<DCRTPoly> KeyStore::loadSimulationSecretKey() const {
+    return readObject<PrivateKey<DCRTPoly>>(path(kSimulationKey));
+}
+
+vector<PrivateKey<DCRTPoly>> KeyStore::loadShares(int numParties) const {
+    vector<PrivateKey<DCRTPoly>> shares;
+    for (int i = 0; i < numParties; ++i) {
+        shares.push_back(readObject<PrivateKey<DCRTPoly>>(path("share-" + to_string(i + 1) + ".key")));
+    }
+    return shares;
+}
+
+void KeyStore::loadEvalKeys(const CryptoContext<DCRTPoly>& cc) const {
+    {
+        MappedFile mapped(path(kEvalMult));
+        ispanstream is(mapped.bytes());
+        if (!cc->DeserializeEvalMultKey(is, SerType::BINARY)) {
+            throw runtime_error("Failed to read " + path(kEvalMult));
+        }
+    }
+    MappedFile mapped(path(kEvalRotate));
+    ispanstream is(mapped.bytes());
+    if (!cc->DeserializeEvalAutomorphismKey(is, SerType::BINARY)) {
+        throw runtime_error("Failed to read " + path(kEvalRotate));
+    }
+}
+
+uint64_t KeyStore::sizeOnDisk() const {
+    uint64_t total = 0;
+    for (const auto& entry : fs::directory_iterator(m_directory)) {
+        if (entry.is_regular_file()) total += entry.file_size();
+    }
+    return total;
+}
@@ -0,0 +1,80 @@
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include "openfhe.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Configuration the stored keys were generated for. Loading a key store
+// overrides these fields of AppConfig, since rotation keys and slot layout
+// depend on them.
+struct KeyStoreManifest {
+    uint32_t multDepth = 0;
+    size_t vecDim = 0;
+    size_t batchSize = 0;
+    bool packGallery = true;
+    size_t rotationRadix = 0;
+    int numParties = 0;
+    uint32_t ringDim = 0;
+    uint64_t fingerprint = 0;
+    // polyMax sign approximation the depth was planned for (optional in older stores)
+    size_t signDegree = 3;
+    size_t signIterations = 1;
+    double signInputScale = 1.0;
+    // bootstrapping mode; the batch size is then part of the depth budget
+    bool bootstrap = false;
+    uint32_t bootstrapLevelBudget = 0;
+};
+
+// Directory holding a serialized CryptoContext and its keys:
+//
+//   manifest.txt            generation parameters, checked on load
+//   cryptocontext.bin       CKKS parameters
+//   public.key              encryption key
+//   eval-mult.key           relinearization key
+//   eval-rotate.key         rotation (automorphism) keys
+//   simulation-secret.key   stand-in for the combined threshold shares
+//   share-<i>.key           simulated per-party shares
+//
+// Evaluation keys dominate the size of the store; they are read from a memory
+// mapping and only when the first homomorphic evaluation needs them, so
+// encrypt-only and decrypt-only processes never pay for them.
+class KeyStore {
+public:
+    explicit KeyStore(std::string directory);
+
+    bool exists() const;
+    const std::string& directory() const { return m_directory; }
+
+    // writes a complete store into <directory>.tmp and then swaps it in; an
+    // interrupted save leaves either the new store or one without a manifest,
+    // never old and new files mixed
+    void save(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+              const lbcrypto::PublicKey<lbcrypto::DCRTPoly>& publicKey,
+              const lbcrypto::PrivateKey<lbcrypto::DCRTPoly>& simulationSecretKey,
+              const std::vector<lbcrypto::PrivateKey<lbcrypto::DCRTPoly>>& shares,
+              const KeyStoreManifest& manifest) const;
+
+    KeyStoreManifest loadManifest() const;
+
+    // drops every context and key OpenFHE has cached, then loads the stored context
+    lbcrypto::CryptoContext<lbcrypto::DCRTPoly> loadContext() const;
+    lbcrypto::PublicKey<lbcrypto::DCRTPoly> loadPublicKey() const;
+    lbcrypto::PrivateKey<lbcrypto::DCRTPoly> loadSimulationSecretKey() const;
+    std::vector<lbcrypto::PrivateKey<lbcrypto::DCRTPoly>> loadShares(int numParties) const;
+
+    // registers the relinearization and rotation keys with the context
+    void loadEvalKeys(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc) const;
+
+    uint64_t sizeOnDisk() const;
+
+private:
+    std::string path(const std::string& name) const;
+    static std::string path(const std::string& directory, const std::string& name);
+
+    std::string m_directory;
+};
+
+#endif // KEY_STORE_H
@@ -0,0 +1,37 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+struct LatencySummary {
+    size_t count = 0;
+    double meanMs = 0.0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+inline LatencySummary summarizeLatencies(std::vector<double> ms) {
+    LatencySummary s;
+    s.count = ms.size();
+    if (ms.empty()) return s;
+    std::sort(ms.begin(), ms.end());
+    double total = 0.0;
+    for (double v : ms) total += v;
+    s.meanMs = total / ms.size();
+    s.p50Ms = ms[(ms.size() - 1) / 2];
+    s.p95Ms = ms[(ms.size() - 1) * 95 / 100];
+    s.maxMs = ms.back();
+    return s;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const LatencySummary& s) {
+    return os << std::fixed << std::setprecision(1) << "mean " << s.meanMs << "ms, p50 " << s.p50Ms
+              << "ms, p95 " << s.p95Ms << "ms, max " << s.maxMs << "ms";
+}
+
+#endif // LATENCY_STATS_H
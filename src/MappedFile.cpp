@@ -0,0 +1,41 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(const string& path) : m_path(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Cannot open file: " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw runtime_error("Cannot stat file: " + path);
+    }
+    m_size = (uint64_t)st.st_size;
+    if (m_size == 0) {
+        ::close(fd);
+        return;
+    }
+    void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) throw runtime_error("Cannot map file: " + path);
+    m_data = static_cast<const char*>(mapped);
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) munmap(const_cast<char*>(m_data), m_size);
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t length) const {
+    if (!m_data || offset >= m_size) return;
+    length = min(length, m_size - offset);
+    // madvise wants a page-aligned start
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page - 1);
+    madvise(const_cast<char*>(m_data) + start, offset + length - start, MADV_WILLNEED);
+}
@@ -0,0 +1,32 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+    std::span<const char> bytes() const { return {m_data, m_size}; }
+    const std::string& path() const { return m_path; }
+
+    // MADV_WILLNEED on [offset, offset + length), rounded out to pages
+    void prefetch(uint64_t offset, uint64_t length) const;
+
+private:
+    std::string m_path;
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,120 @@
+#include "Metrics.h"
+#include "ResourceUsage.h"
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const char* counterName(Counter counter) {
+    switch (counter) {
+        case Counter::EvalMult: return "eval_mult";
+        case Counter::EvalRotate: return "eval_rotate";
+        case Counter::KeySwitch: return "key_switch";
+        case Counter::LevelsConsumed: return "levels_consumed";
+        case Counter::EvalMultEstimated: return "eval_mult_estimated";
+        case Counter::KeySwitchEstimated: return "key_switch_estimated";
+        case Counter::PolyMax: return "polymax";
+        case Counter::AveragedMerge: return "averaged_merge";
+        case Counter::Bootstrap: return "bootstrap";
+        case Counter::RecordsRead: return "records_read";
+        case Counter::BytesRead: return "bytes_read";
+        case Counter::Count_: break;
+    }
+    return "unknown";
+}
+
+const char* stageName(Stage stage) {
+    switch (stage) {
+        case Stage::EncryptGallery: return "encrypt_gallery";
+        case Stage::Deserialize: return "deserialize";
+        case Stage::Similarity: return "similarity";
+        case Stage::Merge: return "merge";
+        case Stage::AnyMatchStep: return "any_match_step";
+        case Stage::Bootstrap: return "bootstrap";
+        case Stage::Decrypt: return "decrypt";
+        case Stage::Count_: break;
+    }
+    return "unknown";
+}
+
+// one past the deepest non-empty histogram bucket
+template <typename Buckets>
+size_t usedBuckets(const Buckets& buckets) {
+    size_t used = buckets.size();
+    while (used > 0 && buckets[used - 1].load(memory_order_relaxed) == 0) --used;
+    return used;
+}
+
+} // namespace
+
+void Metrics::addStageTime(Stage stage, uint64_t nanoseconds) {
+    s_stageNanos[(size_t)stage].fetch_add(nanoseconds, memory_order_relaxed);
+    s_stageCalls[(size_t)stage].fetch_add(1, memory_order_relaxed);
+}
+
+void Metrics::reset() {
+    for (auto& c : s_counters) c = 0;
+    for (auto& c : s_stageNanos) c = 0;
+    for (auto& c : s_stageCalls) c = 0;
+    for (auto& c : s_levels) c = 0;
+}
+
+void Metrics::writeJson(ostream& os) {
+    os << "{\n  \"counters\": {";
+    for (size_t i = 0; i < s_counters.size(); ++i) {
+        os << (i ? ", " : "") << "\"" << counterName((Counter)i) << "\": " << s_counters[i].load();
+    }
+    os << "},\n  \"stages\": {";
+    for (size_t i = 0; i < s_stageNanos.size(); ++i) {
+        os << (i ? ", " : "") << "\"" << stageName((Stage)i) << "\": {\"calls\": " << s_stageCalls[i].load()
+           << ", \"seconds\": " << s_stageNanos[i].load() * 1e-9 << "}";
+    }
+    os << "},\n  \"level_histogram\": [";
+    for (size_t i = 0, used = usedBuckets(s_levels); i < used; ++i) {
+        os << (i ? ", " : "") << s_levels[i].load();
+    }
+    os << "],\n  \"peak_rss_bytes\": " << peakRssBytes() << "\n}\n";
+}
+
+void Metrics::writePrometheus(ostream& os) {
+    for (size_t i = 0; i < s_counters.size(); ++i) {
+        os << "# TYPE biometric_" << counterName((Counter)i) << "_total counter\n"
+           << "biometric_" << counterName((Counter)i) << "_total " << s_counters[i].load() << "\n";
+    }
+    os << "# TYPE biometric_stage_seconds_total counter\n";
+    for (size_t i = 0; i < s_stageNanos.size(); ++i) {
+        os << "biometric_stage_seconds_total{stage=\"" << stageName((Stage)i) << "\"} " << s_stageNanos[i].load() * 1e-9 << "\n";
+    }
+    os << "# TYPE biometric_stage_calls_total counter\n";
+    for (size_t i = 0; i < s_stageCalls.size(); ++i) {
+        os << "biometric_stage_calls_total{stage=\"" << stageName((Stage)i) << "\"} " << s_stageCalls[i].load() << "\n";
+    }
+    // cumulative buckets, as Prometheus histograms expect
+    os << "# TYPE biometric_merge_level histogram\n";
+    uint64_t cumulative = 0;
+    uint64_t levelSum = 0;
+    for (size_t i = 0, used = usedBuckets(s_levels); i < used; ++i) {
+        cumulative += s_levels[i].load();
+        levelSum += i * s_levels[i].load();
+        os << "biometric_merge_level_bucket{le=\"" << i << "\"} " << cumulative << "\n";
+    }
+    os << "biometric_merge_level_bucket{le=\"+Inf\"} " << cumulative << "\n"
+       << "biometric_merge_level_sum " << levelSum << "\n"
+       << "biometric_merge_level_count " << cumulative << "\n"
+       << "# TYPE biometric_peak_rss_bytes gauge\n"
+       << "biometric_peak_rss_bytes " << peakRssBytes() << "\n";
+}
+
+void Metrics::dump(const string& path) {
+    ofstream out(path);
+    if (!out) throw runtime_error("Cannot write metrics to " + path);
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".prom") == 0) {
+        writePrometheus(out);
+    } else {
+        writeJson(out);
+    }
+    if (!out) throw runtime_error("Failed writing metrics to " + path);
+}
@@ -0,0 +1,99 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Process-wide counters for the homomorphic hot path, dumped as JSON or
+// Prometheus text. Off by default: every hook is then a relaxed atomic load
+// and a branch. Operation counters are bumped at the OpenFHE call sites
+// (CountedEval.h). Products OpenFHE runs inside one call cannot be counted
+// that way; their counters are model estimates and say so in their names.
+enum class Counter {
+    EvalMult,        // ciphertext-ciphertext products, relinearized or not
+    EvalRotate,      // rotations, hoisted ones included
+    KeySwitch,       // relinearizations and rotations
+    LevelsConsumed,  // levels dropped by similarities, comparisons, steps and averages, read off their outputs
+    EvalMultEstimated,   // products inside EvalChebyshevSeries, from the Paterson-Stockmeyer cost model
+    KeySwitchEstimated,  // their relinearizations, likewise
+    PolyMax,         // comparisons evaluated by the tournament
+    AveragedMerge,   // tournament merges that ran out of depth and fell back to pureAverage
+    Bootstrap,       // running maxima refreshed by EvalBootstrap
+    RecordsRead,     // gallery records deserialized from the file (cache hits excluded)
+    BytesRead,       // serialized bytes of those records
+    Count_,
+};
+
+// Stages time the whole call on every thread that enters them, so with several
+// workers a stage can report more seconds than the wall clock.
+enum class Stage {
+    EncryptGallery,
+    Deserialize,
+    Similarity,
+    Merge,
+    AnyMatchStep,
+    Bootstrap,
+    Decrypt,
+    Count_,
+};
+
+class Metrics {
+public:
+    // level histogram buckets; deeper ciphertexts land in the last one
+    static constexpr size_t kLevelBuckets = 64;
+
+    static void enable(bool on) { s_enabled.store(on, std::memory_order_relaxed); }
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    static void add(Counter counter, uint64_t n = 1) {
+        if (enabled()) s_counters[(size_t)counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // levels consumed by a ciphertext produced along the reduction tree
+    static void recordLevel(uint32_t level) {
+        if (enabled()) s_levels[level < kLevelBuckets ? level : kLevelBuckets - 1].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void addStageTime(Stage stage, uint64_t nanoseconds);
+    static void reset();
+
+    static void writeJson(std::ostream& os);
+    static void writePrometheus(std::ostream& os);
+
+    // Prometheus text for *.prom, JSON otherwise
+    static void dump(const std::string& path);
+
+private:
+    static inline std::atomic<bool> s_enabled{false};
+    static inline std::array<std::atomic<uint64_t>, (size_t)Counter::Count_> s_counters{};
+    static inline std::array<std::atomic<uint64_t>, (size_t)Stage::Count_> s_stageNanos{};
+    static inline std::array<std::atomic<uint64_t>, (size_t)Stage::Count_> s_stageCalls{};
+    static inline std::array<std::atomic<uint64_t>, kLevelBuckets> s_levels{};
+};
+
+// Adds the lifetime of the scope to a stage; reads no clock when metrics are off.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : m_stage(stage), m_active(Metrics::enabled()) {
+        if (m_active) m_start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (!m_active) return;
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        Metrics::addStageTime(m_stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage m_stage;
+    bool m_active;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,41 @@
+#include "OnlineTournament.h"
+#include <stdexcept>
+#include <utility>
+
+using namespace lbcrypto;
+using namespace std;
+
+OnlineTournament::OnlineTournament(Merge merge, size_t capacityHint) : m_merge(move(merge)) {
+    size_t levels = 1;
+    while (((size_t)1 << (levels - 1)) < capacityHint) ++levels;
+    m_slots.resize(levels);
+}
+
+void OnlineTournament::push(Ct sim) {
+    size_t level = 0;
+    for (size_t n = m_count; n & 1; n >>= 1, ++level) {
+        sim = m_merge(m_slots[level], sim);
+        m_slots[level].reset();
+    }
+    if (level == m_slots.size()) m_slots.emplace_back();
+    m_slots[level] = move(sim);
+    ++m_count;
+}
+
+OnlineTournament::Ct OnlineTournament::finish() {
+    if (m_count == 0) throw runtime_error("Cannot process an empty batch.");
+    Ct acc;
+    for (size_t level = 0; level < m_slots.size(); ++level) {
+        if (!m_slots[level]) continue;
+        acc = acc ? m_merge(m_slots[level], acc) : move(m_slots[level]);
+        m_slots[level].reset();
+    }
+    m_count = 0;
+    return acc;
+}
+
+size_t OnlineTournament::liveCount() const {
+    size_t live = 0;
+    for (const auto& slot : m_slots) live += slot ? 1 : 0;
+    return live;
+}
@@ -0,0 +1,41 @@
+#ifndef ONLINE_TOURNAMENT_H
+#define ONLINE_TOURNAMENT_H
+
+#include "openfhe.h"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Single-threaded tournament that merges each similarity as soon as it arrives.
+//
+// Partial maxima live in a binary counter: slot k holds the merge of a full
+// subtree of 2^k leaves, so at most log2(n) + 1 ciphertexts are alive instead
+// of the whole batch. Pushing carries like an increment (older subtree on the
+// left); finish() folds the remaining slots from the lowest upwards, which is
+// exactly the shape of the round-by-round tournament that carries an odd last
+// node up, so results match TournamentReducer bit for bit.
+class OnlineTournament {
+public:
+    using Ct = lbcrypto::Ciphertext<lbcrypto::DCRTPoly>;
+    using Merge = std::function<Ct(const Ct&, const Ct&)>;
+
+    // capacityHint sizes the slot stack once; it grows past it if needed
+    OnlineTournament(Merge merge, size_t capacityHint);
+
+    void push(Ct sim);
+
+    // maximum of everything pushed since the last finish(); leaves the tournament empty
+    Ct finish();
+
+    size_t size() const { return m_count; }
+
+    // ciphertexts currently held
+    size_t liveCount() const;
+
+private:
+    Merge m_merge;
+    std::vector<Ct> m_slots;   // m_slots[k] set iff bit k of m_count is set
+    size_t m_count = 0;
+};
+
+#endif // ONLINE_TOURNAMENT_H
@@ -0,0 +1,172 @@
+#include "PlaintextSimilarity.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kQueryTile = 4;
+constexpr size_t kGalleryTile = 2;
+constexpr size_t kBlockBytes = 256 * 1024;   // gallery rows kept hot in L2 while every query tile passes
+
+// 256-bit vectors through the GCC/Clang vector extension: AVX registers where the
+// target has them, pairs of SSE registers otherwise. Row strides are multiples of 64 bytes.
+template <typename T>
+struct Simd {
+    typedef T Vec __attribute__((vector_size(32)));
+    static constexpr size_t kLanes = 32 / sizeof(T);
+};
+
+// dot products of the first QT queries of a tile with kGalleryTile padded rows;
+// each loaded gallery vector is used QT times, each query vector kGalleryTile times
+template <typename T, size_t QT>
+void scoreTile(const T* const (&q)[kQueryTile], const T* const (&g)[kGalleryTile], size_t stride,
+               double (&scores)[kQueryTile][kGalleryTile]) {
+    using V = typename Simd<T>::Vec;
+    constexpr size_t L = Simd<T>::kLanes;
+    V acc[QT][kGalleryTile] = {};
+    for (size_t k = 0; k < stride; k += L) {
+        V gv[kGalleryTile];
+        for (size_t j = 0; j < kGalleryTile; ++j) memcpy(&gv[j], g[j] + k, sizeof(V));
+        for (size_t i = 0; i < QT; ++i) {
+            V qv;
+            memcpy(&qv, q[i] + k, sizeof(V));
+            for (size_t j = 0; j < kGalleryTile; ++j) acc[i][j] += qv * gv[j];
+        }
+    }
+    for (size_t i = 0; i < QT; ++i) {
+        for (size_t j = 0; j < kGalleryTile; ++j) {
+            T sum = 0;
+            for (size_t l = 0; l < L; ++l) sum += acc[i][j][l];
+            scores[i][j] = sum;
+        }
+    }
+}
+
+bool better(const SimilarityMatch& a, const SimilarityMatch& b) {
+    return a.score > b.score || (a.score == b.score && a.index < b.index);
+}
+
+// the k best matches seen so far, worst on top of the heap
+class TopK {
+public:
+    explicit TopK(size_t k) : m_k(k) { m_heap.reserve(k); }
+
+    void offer(size_t index, double score) {
+        if (m_k == 0) return;
+        SimilarityMatch m{index, score};
+        if (m_heap.size() < m_k) {
+            m_heap.push_back(m);
+            push_heap(m_heap.begin(), m_heap.end(), better);
+        } else if (better(m, m_heap.front())) {
+            pop_heap(m_heap.begin(), m_heap.end(), better);
+            m_heap.back() = m;
+            push_heap(m_heap.begin(), m_heap.end(), better);
+        }
+    }
+
+    const vector<SimilarityMatch>& matches() const { return m_heap; }
+
+private:
+    size_t m_k;
+    vector<SimilarityMatch> m_heap;
+};
+
+struct PartialReport {
+    vector<TopK> topK;
+    vector<size_t> aboveThreshold;
+};
+
+template <typename T>
+void scoreRange(const TemplateMatrix<T>& queries, const TemplateMatrix<T>& gallery, size_t first, size_t last,
+                double threshold, const vector<T>& zeroRow, PartialReport& out) {
+    const size_t stride = gallery.stride();
+    const size_t blockRows = max(kGalleryTile, kBlockBytes / (stride * sizeof(T)) / kGalleryTile * kGalleryTile);
+    // tiles reaching past the last row read the zero row; those scores are dropped
+    auto rowOrZero = [&](const TemplateMatrix<T>& m, size_t i, size_t end) {
+        return i < end ? m.rowData(i) : zeroRow.data();
+    };
+
+    for (size_t block = first; block < last; block += blockRows) {
+        const size_t blockEnd = min(last, block + blockRows);
+        for (size_t q0 = 0; q0 < queries.rows(); q0 += kQueryTile) {
+            const T* q[kQueryTile];
+            for (size_t i = 0; i < kQueryTile; ++i) q[i] = rowOrZero(queries, q0 + i, queries.rows());
+            for (size_t g0 = block; g0 < blockEnd; g0 += kGalleryTile) {
+                const T* g[kGalleryTile];
+                for (size_t j = 0; j < kGalleryTile; ++j) g[j] = rowOrZero(gallery, g0 + j, blockEnd);
+
+                double scores[kQueryTile][kGalleryTile];
+                switch (min(kQueryTile, queries.rows() - q0)) {
+                case 1: scoreTile<T, 1>(q, g, stride, scores); break;
+                case 2: scoreTile<T, 2>(q, g, stride, scores); break;
+                case 3: scoreTile<T, 3>(q, g, stride, scores); break;
+                default: scoreTile<T, 4>(q, g, stride, scores); break;
+                }
+                for (size_t i = 0; i < kQueryTile && q0 + i < queries.rows(); ++i) {
+                    for (size_t j = 0; j < kGalleryTile && g0 + j < blockEnd; ++j) {
+                        out.topK[q0 + i].offer(g0 + j, scores[i][j]);
+                        if (scores[i][j] > threshold) ++out.aboveThreshold[q0 + i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+template <typename T>
+SimilarityReport scoreTemplates(const TemplateMatrix<T>& queries, const TemplateMatrix<T>& gallery,
+                                size_t topK, double threshold, size_t threads) {
+    if (gallery.dim() == 0) throw invalid_argument("Templates must have a positive dimension");
+    if (queries.dim() != gallery.dim()) {
+        throw invalid_argument("Query dimension " + to_string(queries.dim()) + " does not match gallery dimension " +
+                               to_string(gallery.dim()));
+    }
+
+    // contiguous row ranges, whole gallery tiles each
+    const size_t tiles = (gallery.rows() + kGalleryTile - 1) / kGalleryTile;
+    const size_t workers = max<size_t>(1, min(threads, tiles));
+    vector<PartialReport> partials(workers);
+    for (auto& partial : partials) {
+        partial.topK.assign(queries.rows(), TopK(topK));
+        partial.aboveThreshold.assign(queries.rows(), 0);
+    }
+    const vector<T> zeroRow(gallery.stride(), T(0));
+    {
+        vector<jthread> pool;
+        for (size_t w = 0; w < workers; ++w) {
+            const size_t first = min(gallery.rows(), tiles * w / workers * kGalleryTile);
+            const size_t last = min(gallery.rows(), tiles * (w + 1) / workers * kGalleryTile);
+            pool.emplace_back([&, first, last, w] {
+                scoreRange(queries, gallery, first, last, threshold, zeroRow, partials[w]);
+            });
+        }
+    }
+
+    SimilarityReport report;
+    report.topK.resize(queries.rows());
+    report.aboveThreshold.assign(queries.rows(), 0);
+    for (size_t q = 0; q < queries.rows(); ++q) {
+        auto& best = report.topK[q];
+        for (const auto& partial : partials) {
+            const auto& matches = partial.topK[q].matches();
+            best.insert(best.end(), matches.begin(), matches.end());
+            report.aboveThreshold[q] += partial.aboveThreshold[q];
+        }
+        sort(best.begin(), best.end(), better);
+        if (best.size() > topK) best.resize(topK);
+    }
+    return report;
+}
+
+template SimilarityReport scoreTemplates<float>(const TemplateMatrix<float>&, const TemplateMatrix<float>&,
+                                                size_t, double, size_t);
+template SimilarityReport scoreTemplates<double>(const TemplateMatrix<double>&, const TemplateMatrix<double>&,
+                                                 size_t, double, size_t);
@@ -0,0 +1,31 @@
+#ifndef PLAINTEXT_SIMILARITY_H
+#define PLAINTEXT_SIMILARITY_H
+
+#include "TemplateMatrix.h"
+#include <cstddef>
+#include <vector>
+
+struct SimilarityMatch {
+    size_t index;   // gallery row
+    double score;
+};
+
+struct SimilarityReport {
+    std::vector<std::vector<SimilarityMatch>> topK;   // per query, best first; ties go to the lower index
+    std::vector<size_t> aboveThreshold;              // per query, gallery rows scoring > threshold
+};
+
+// Ground truth for the encrypted pipeline: the dot product of every query with
+// every gallery row (cosine similarity for unit-normalized templates), reduced
+// to the topK best rows and the number above threshold per query.
+//
+// Gallery rows are split into one contiguous range per thread. Each thread walks
+// its range in blocks sized for L2 and scores every block against all queries,
+// four queries by two rows at a time, so every loaded row is reused across the
+// query tile. Float32 halves the bandwidth but sums in float32 as well, so
+// scores within ~1e-6 of the threshold may count differently from float64.
+template <typename T>
+SimilarityReport scoreTemplates(const TemplateMatrix<T>& queries, const TemplateMatrix<T>& gallery,
+                                size_t topK, double threshold, size_t threads = 1);
+
+#endif // PLAINTEXT_SIMILARITY_H
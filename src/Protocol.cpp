@@ -0,0 +1,158 @@
+#include "Protocol.h"
+#include <cerrno>
+#include <cstring>
+#include <spanstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ciphertext-ser.h"
+#include "cryptocontext-ser.h"
+#include "scheme/ckksrns/ckksrns-ser.h"
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+// serialization metadata (cereal names, parameter ids) on top of the raw coefficients
+constexpr uint64_t kSerializationSlack = 1 << 20;
+
+sockaddr_un unixAddress(const string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw runtime_error("Socket path too long: " + path);
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+void writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("Socket write failed: ") + strerror(errno));
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+}
+
+// returns bytes read; short only at end of stream
+size_t readAll(int fd, char* data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = ::recv(fd, data + total, length - total, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("Socket read failed: ") + strerror(errno));
+        }
+        if (n == 0) break;
+        total += (size_t)n;
+    }
+    return total;
+}
+
+} // namespace
+
+UniqueFd::~UniqueFd() {
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+UniqueFd& UniqueFd::operator=(UniqueFd&& other) noexcept {
+    if (this != &other) {
+        if (m_fd >= 0) ::close(m_fd);
+        m_fd = other.release();
+    }
+    return *this;
+}
+
+int UniqueFd::release() {
+    int fd = m_fd;
+    m_fd = -1;
+    return fd;
+}
+
+UniqueFd listenUnix(const string& path, int backlog) {
+    auto addr = unixAddress(path);
+    UniqueFd fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!fd) throw runtime_error(string("socket() failed: ") + strerror(errno));
+    ::unlink(path.c_str());
+    if (::bind(fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw runtime_error("Cannot bind " + path + ": " + strerror(errno));
+    }
+    if (::listen(fd.get(), backlog) != 0) {
+        throw runtime_error("Cannot listen on " + path + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+UniqueFd connectUnix(const string& path) {
+    auto addr = unixAddress(path);
+    UniqueFd fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!fd) throw runtime_error(string("socket() failed: ") + strerror(errno));
+    if (::connect(fd.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw runtime_error("Cannot connect to " + path + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+void sendMessage(int fd, MessageType type, span<const char> payload) {
+    MessageHeader header{(uint32_t)type, 0, payload.size()};
+    writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    writeAll(fd, payload.data(), payload.size());
+}
+
+uint64_t maxMessagePayload(const CryptoContext<DCRTPoly>& cc) {
+    const uint64_t towers = cc->GetElementParams()->GetParams().size();
+    const uint64_t polynomialBytes = (uint64_t)cc->GetRingDimension() * towers * sizeof(uint64_t);
+    return 2 * 3 * polynomialBytes + kSerializationSlack + sizeof(ShardRange);
+}
+
+bool receiveMessage(int fd, Message& message, uint64_t maxPayload) {
+    MessageHeader header;
+    size_t got = readAll(fd, reinterpret_cast<char*>(&header), sizeof(header));
+    if (got == 0) return false;
+    if (got != sizeof(header)) throw runtime_error("Connection closed inside a message header");
+    if (header.length > maxPayload) throw runtime_error("Oversized message: " + to_string(header.length) + " bytes");
+
+    message.type = (MessageType)header.type;
+    message.payload.resize(header.length);
+    if (readAll(fd, message.payload.data(), header.length) != header.length) {
+        throw runtime_error("Connection closed inside a message payload");
+    }
+    return true;
+}
+
+string serializeCiphertext(const Ciphertext<DCRTPoly>& ct) {
+    ostringstream oss(ios::binary);
+    Serial::Serialize(ct, oss, SerType::BINARY);
+    return move(oss).str();
+}
+
+Ciphertext<DCRTPoly> deserializeCiphertext(span<const char> bytes) {
+    ispanstream is(bytes);
+    Ciphertext<DCRTPoly> ct;
+    Serial::Deserialize(ct, is, SerType::BINARY);
+    if (is.fail() || !ct) throw runtime_error("Malformed ciphertext payload");
+    return ct;
+}
+
+string encodeShardQuery(const ShardRange& range, string_view query) {
+    string payload(sizeof(range), '\0');
+    memcpy(payload.data(), &range, sizeof(range));
+    payload.append(query);
+    return payload;
+}
+
+ShardRange decodeShardQuery(span<const char> payload, span<const char>& query) {
+    ShardRange range;
+    if (payload.size() <= sizeof(range)) throw runtime_error("Truncated shard query");
+    memcpy(&range, payload.data(), sizeof(range));
+    if (range.first >= range.last) throw runtime_error("Empty shard range");
+    query = payload.subspan(sizeof(range));
+    return range;
+}
@@ -0,0 +1,81 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "openfhe.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Framed messages over a local stream socket: a fixed header followed by
+// `length` payload bytes. Ciphertexts travel in OpenFHE's binary serialization.
+enum class MessageType : uint32_t {
+    Query = 1,    // client -> server: serialized query ciphertext
+    Result = 2,   // server -> client: serialized encrypted maximum
+    Error = 3,    // server -> client: error text, the connection stays usable
+    ShardQuery = 4,  // aggregator -> worker: ShardRange, then the serialized query; answered with
+                     // a Result holding the packed maximum of that range (not folded across blocks)
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t length;
+};
+static_assert(sizeof(MessageHeader) == 16, "MessageHeader is part of the wire format");
+
+// gallery records [first, last)
+struct ShardRange {
+    uint64_t first;
+    uint64_t last;
+};
+static_assert(sizeof(ShardRange) == 16, "ShardRange is part of the wire format");
+
+struct Message {
+    MessageType type;
+    std::vector<char> payload;
+};
+
+// Owns a file descriptor.
+class UniqueFd {
+public:
+    UniqueFd() = default;
+    explicit UniqueFd(int fd) : m_fd(fd) {}
+    ~UniqueFd();
+    UniqueFd(UniqueFd&& other) noexcept : m_fd(other.release()) {}
+    UniqueFd& operator=(UniqueFd&& other) noexcept;
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+
+    int get() const { return m_fd; }
+    int release();
+    explicit operator bool() const { return m_fd >= 0; }
+
+private:
+    int m_fd = -1;
+};
+
+// replaces a stale socket file at path
+UniqueFd listenUnix(const std::string& path, int backlog = 16);
+UniqueFd connectUnix(const std::string& path);
+
+void sendMessage(int fd, MessageType type, std::span<const char> payload);
+
+// largest message a peer may send for cc: a ciphertext of three polynomials at
+// the top of the modulus chain, with room for its serialization and a ShardRange
+uint64_t maxMessagePayload(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc);
+
+// false on a clean end of stream before a header; frames over maxPayload are
+// refused before anything is allocated for them
+bool receiveMessage(int fd, Message& message, uint64_t maxPayload);
+
+std::string serializeCiphertext(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct);
+lbcrypto::Ciphertext<lbcrypto::DCRTPoly> deserializeCiphertext(std::span<const char> bytes);
+
+std::string encodeShardQuery(const ShardRange& range, std::string_view query);
+
+// returns the range and points query at the ciphertext bytes inside payload
+ShardRange decodeShardQuery(std::span<const char> payload, std::span<const char>& query);
+
+#endif // PROTOCOL_H
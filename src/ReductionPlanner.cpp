@@ -0,0 +1,230 @@
+#include "ReductionPlanner.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+size_t nextPowerOfTwo(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+size_t ceilLog2(size_t n) {
+    size_t rounds = 0;
+    while (((size_t)1 << rounds) < n) ++rounds;
+    return rounds;
+}
+
+double evalPolynomial(const vector<double>& coeffs, double x) {
+    double y = 0.0;
+    for (size_t k = coeffs.size(); k-- > 0; ) y = y * x + coeffs[k];
+    return y;
+}
+
+// largest log2(QP) for 128-bit classic security (HE standard table used by OpenFHE)
+const pair<uint32_t, uint32_t> kMaxLogQP[] = {
+    {1u << 10, 27}, {1u << 11, 54}, {1u << 12, 109}, {1u << 13, 218},
+    {1u << 14, 438}, {1u << 15, 881}, {1u << 16, 1761}, {1u << 17, 3524},
+};
+
+// OpenFHE's HYBRID default: three digits past depth 3, auxiliary primes of up to 60 bits
+constexpr uint32_t kAuxModBits = 60;
+
+uint32_t mergeDepthFor(const ReductionPlanInput& input, const SignApproximation& sign) {
+    return input.mergeDepth ? input.mergeDepth(sign) : polyMaxDepth(sign);
+}
+
+} // namespace
+
+vector<double> signPolynomial(size_t degree) {
+    switch (degree) {
+        case 3: return {0.0, 3.0 / 2, 0.0, -1.0 / 2};
+        case 5: return {0.0, 15.0 / 8, 0.0, -10.0 / 8, 0.0, 3.0 / 8};
+        case 7: return {0.0, 35.0 / 16, 0.0, -35.0 / 16, 0.0, 21.0 / 16, 0.0, -5.0 / 16};
+    }
+    throw invalid_argument("Sign polynomial degree must be 3, 5 or 7, got " + to_string(degree));
+}
+
+uint32_t signPolynomialDepth(size_t degree) {
+    return (uint32_t)ceilLog2(degree + 1);
+}
+
+size_t signPolynomialMults(size_t degree) {
+    // x^2, x^4 and one product per odd term above x
+    switch (degree) {
+        case 3: return 2;
+        case 5: return 4;
+        case 7: return 6;
+    }
+    throw invalid_argument("Sign polynomial degree must be 3, 5 or 7, got " + to_string(degree));
+}
+
+uint32_t polyMaxDepth(const SignApproximation& sign) {
+    return (uint32_t)sign.iterations * signPolynomialDepth(sign.degree) + 1;
+}
+
+double polyMaxError(const SignApproximation& sign, double maxDifference) {
+    auto f = signPolynomial(sign.degree);
+    double worst = 0.0;
+    constexpr int kSamples = 4000;
+    for (int i = 1; i <= kSamples; ++i) {
+        double d = maxDifference * i / kSamples;
+        double s = sign.inputScale * d;
+        for (size_t k = 0; k < sign.iterations; ++k) s = evalPolynomial(f, s);
+        // polyMax = (a + b)/2 + d * sign(d)/2 undershoots max by d * (1 - sign(d)) / 2
+        worst = max(worst, fabs(d * (1.0 - s) / 2));
+    }
+    return worst;
+}
+
+uint32_t minimumRingDimension(uint32_t multDepth, uint32_t firstModBits, uint32_t scalingModBits) {
+    uint32_t digits = multDepth > 3 ? 3 : (multDepth > 0 ? 2 : 1);
+    uint32_t logQ = firstModBits + multDepth * scalingModBits;
+    uint32_t logP = kAuxModBits * ((multDepth + 1 + digits - 1) / digits);
+    for (const auto& [ringDim, maxLogQP] : kMaxLogQP) {
+        if (logQ + logP <= maxLogQP) return ringDim;
+    }
+    return 0;
+}
+
+ReductionPlan planReduction(const ReductionPlanInput& input) {
+    // shallowest sign approximation within the target; the most accurate one if none is
+    ReductionPlan plan;
+    bool found = false;
+    double bestError = INFINITY;
+    for (size_t degree : {3, 5, 7}) {
+        for (size_t iterations = 1; iterations <= 6; ++iterations) {
+            SignApproximation sign{degree, iterations, 1.0 / input.maxDifference};
+            uint32_t depth = mergeDepthFor(input, sign);
+            if (depth == 0) continue;
+            double error = polyMaxError(sign, input.maxDifference);
+            size_t mults = iterations * signPolynomialMults(degree);
+            bool meets = error <= input.targetError;
+            bool better;
+            if (meets != found) {
+                better = meets;
+            } else if (meets) {
+                size_t planMults = plan.sign.iterations * signPolynomialMults(plan.sign.degree);
+                better = depth < plan.mergeDepth || (depth == plan.mergeDepth && mults < planMults);
+            } else {
+                better = error < bestError;
+            }
+            if (better) {
+                plan.sign = sign;
+                plan.mergeDepth = depth;
+                plan.mergeError = error;
+                bestError = error;
+                found = found || meets;
+            }
+        }
+    }
+    if (plan.mergeDepth == 0) throw invalid_argument("The comparison kernel cannot evaluate any planned sign approximation");
+    ReductionPlan layout = planReduction(input, plan.sign);
+    layout.meetsTarget = found;
+    layout.mergeError = plan.mergeError;
+    return layout;
+}
+
+ReductionPlan planReduction(const ReductionPlanInput& input, const SignApproximation& sign) {
+    if (input.numVectors == 0 || input.vecDim == 0 || input.batchSize == 0) {
+        throw invalid_argument("Planner needs a non-empty gallery, vector dimension and batch size");
+    }
+    ReductionPlan plan;
+    plan.sign = sign;
+    plan.mergeDepth = mergeDepthFor(input, sign);
+    if (plan.mergeDepth == 0) {
+        throw invalid_argument("The comparison kernel cannot evaluate a degree-" + to_string(sign.degree) + " x " +
+                               to_string(sign.iterations) + " sign approximation");
+    }
+    plan.mergeError = polyMaxError(sign, 1.0 / sign.inputScale);
+    plan.meetsTarget = true;
+
+    // similarity product, plus the block mask when templates share a ciphertext
+    plan.dotDepth = input.packGallery ? 2 : 1;
+    const size_t stride = nextPowerOfTwo(input.vecDim);
+
+    // the slot layout depends on the ring and the ring on the depth: take the
+    // smallest ring whose own layout needs no more depth than it can hold
+    for (const auto& [ringDim, maxLogQP] : kMaxLogQP) {
+        size_t perCiphertext = 1;
+        if (input.packGallery) {
+            size_t slots = ringDim / 2;
+            if (stride > slots) continue;
+            perCiphertext = min(slots / stride, nextPowerOfTwo(input.numVectors));
+        }
+        size_t records = (input.numVectors + perCiphertext - 1) / perCiphertext;
+        plan.templatesPerCiphertext = perCiphertext;
+        plan.records = records;
+        plan.batchRounds = ceilLog2(min(input.batchSize, records));
+        plan.chainMerges = (records + input.batchSize - 1) / input.batchSize - 1;
+        plan.foldRounds = ceilLog2(perCiphertext);
+        plan.multDepth = plan.dotDepth + plan.mergeDepth * (uint32_t)plan.mergesOnCriticalPath();
+        plan.ringDim = minimumRingDimension(plan.multDepth, input.firstModBits, input.scalingModBits);
+        if (plan.ringDim != 0 && plan.ringDim <= ringDim) {
+            plan.ringDim = ringDim;
+            return plan;
+        }
+    }
+    throw runtime_error("No ring dimension up to 131072 holds the planned depth " + to_string(plan.multDepth) +
+                        "; raise the batch size or the target error");
+}
+
+ostream& operator<<(ostream& os, const ReductionPlan& plan) {
+    const double range = 1.0 / plan.sign.inputScale;
+    os << "  - Sign approximation: degree " << plan.sign.degree << " x " << plan.sign.iterations
+       << " (input scale " << plan.sign.inputScale << "), worst-case error per comparison "
+       << scientific << setprecision(2) << plan.mergeError << defaultfloat
+       << (plan.meetsTarget ? "" : " (target not reachable, using the most accurate)") << "\n"
+       << "  - Valid for |a - b| <= " << range
+       << (range < 2.0 ? " (assumes non-negative similarities; the sign diverges beyond)" : "") << "\n"
+       << "  - Layout: " << plan.templatesPerCiphertext << " templates per ciphertext, " << plan.records << " records\n"
+       << "  - Merges on the critical path: " << plan.batchRounds << " batch rounds + " << plan.chainMerges
+       << " chained batches + " << plan.foldRounds << " fold rounds\n"
+       << "  - Levels: " << plan.dotDepth << " (similarity) + " << plan.mergesOnCriticalPath() << " x "
+       << plan.mergeDepth << " (polyMax) = " << plan.multDepth << "\n"
+       << "  - Ring dimension: " << plan.ringDim;
+    return os;
+}
+
+BootstrapPlan planBootstrappedReduction(const ReductionPlanInput& input, uint32_t mergeDepth, uint32_t bootstrapDepth) {
+    if (input.vecDim == 0 || input.batchSize == 0 || mergeDepth == 0) {
+        throw invalid_argument("Planner needs a vector dimension, batch size and merge depth");
+    }
+    BootstrapPlan plan;
+    plan.bootstrapDepth = bootstrapDepth;
+    plan.dotDepth = input.packGallery ? 2 : 1;
+    plan.mergeDepth = mergeDepth;
+
+    // the deepest batch tournament that still finishes below the refreshed maximum
+    size_t rounds = bootstrapDepth > plan.dotDepth ? (bootstrapDepth - plan.dotDepth) / mergeDepth : 0;
+    rounds = min(rounds, ceilLog2(input.batchSize));
+    plan.batchSize = min(input.batchSize, (size_t)1 << rounds);
+    plan.batchRounds = ceilLog2(plan.batchSize);
+    plan.multDepth = max(bootstrapDepth, plan.dotDepth + mergeDepth * (uint32_t)plan.batchRounds) + mergeDepth;
+
+    plan.ringDim = minimumRingDimension(plan.multDepth, input.firstModBits, input.scalingModBits);
+    if (plan.ringDim == 0) {
+        throw runtime_error("No ring dimension up to 131072 holds bootstrapping depth " + to_string(plan.multDepth) +
+                            "; lower the level budget");
+    }
+    // the packed layout needs at least one template block
+    if (input.packGallery) plan.ringDim = max<uint32_t>(plan.ringDim, 2 * (uint32_t)nextPowerOfTwo(input.vecDim));
+    return plan;
+}
+
+ostream& operator<<(ostream& os, const BootstrapPlan& plan) {
+    os << "  - Batches of " << plan.batchSize << " records (" << plan.batchRounds << " rounds of "
+       << plan.mergeDepth << " levels after the " << plan.dotDepth << "-level similarity)\n"
+       << "  - Levels: " << plan.multDepth << " (" << plan.bootstrapDepth << " consumed by bootstrapping, "
+       << plan.multDepth - plan.bootstrapDepth << " left for the merge after each refresh)\n"
+       << "  - Ring dimension: " << plan.ringDim;
+    return os;
+}
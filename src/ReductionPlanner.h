@@ -0,0 +1,112 @@
+#ifndef REDUCTION_PLANNER_H
+#define REDUCTION_PLANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <vector>
+
+// Sign approximation used by polyMax: the odd polynomial f_n of the given
+// degree (3, 5 or 7), applied `iterations` times to inputScale * x. f_n maps
+// [-1, 1] onto itself and pushes every point towards -1 or +1, so composing
+// it sharpens the step at the cost of more levels.
+struct SignApproximation {
+    size_t degree = 3;
+    size_t iterations = 1;
+    double inputScale = 1.0;
+};
+
+// power-basis coefficients of f_n for degree 2n+1, indexed by power
+std::vector<double> signPolynomial(size_t degree);
+
+// levels one evaluation of a degree-d odd polynomial needs: ceil(log2(d + 1))
+uint32_t signPolynomialDepth(size_t degree);
+
+// ciphertext-ciphertext multiplications per evaluation
+size_t signPolynomialMults(size_t degree);
+
+// levels of one polyMax: the composed sign polynomial and the product with the difference
+uint32_t polyMaxDepth(const SignApproximation& sign);
+
+// worst case of max(a, b) - polyMax(a, b) over |a - b| <= maxDifference
+double polyMaxError(const SignApproximation& sign, double maxDifference);
+
+// smallest power-of-two ring dimension that holds this depth at 128-bit classic
+// security with HYBRID key switching; 0 if none up to 2^17 does
+uint32_t minimumRingDimension(uint32_t multDepth, uint32_t firstModBits, uint32_t scalingModBits);
+
+struct ReductionPlanInput {
+    size_t numVectors = 0;
+    size_t vecDim = 0;
+    size_t batchSize = 0;
+    bool packGallery = true;
+    double targetError = 0.1;     // per polyMax comparison
+    // |a - b| the sign must handle. The default assumes non-negative similarities in
+    // [0, 1], like the default sign and the reference kernel; the composite sign
+    // diverges past it, so signed cosine similarities need 2
+    double maxDifference = 1.0;
+    uint32_t firstModBits = 60;
+    uint32_t scalingModBits = 50;
+
+    // levels of one comparison with a sign approximation, 0 if the comparison kernel
+    // cannot evaluate it; unset means polyMaxDepth
+    std::function<uint32_t(const SignApproximation&)> mergeDepth;
+};
+
+// Level budget of the streaming maximum: the similarity, then polyMax merges
+// along the longest path of the batch tournament, the chain of batch maxima
+// and the cross-block fold.
+struct ReductionPlan {
+    SignApproximation sign;
+    bool meetsTarget = false;
+    double mergeError = 0.0;
+    uint32_t dotDepth = 0;
+    uint32_t mergeDepth = 0;
+    size_t templatesPerCiphertext = 1;
+    size_t records = 0;
+    size_t batchRounds = 0;
+    size_t chainMerges = 0;
+    size_t foldRounds = 0;
+    uint32_t multDepth = 0;
+    uint32_t ringDim = 0;
+
+    size_t mergesOnCriticalPath() const { return batchRounds + chainMerges + foldRounds; }
+};
+
+// picks the shallowest sign approximation the comparison kernel can evaluate
+// that meets the target (fewest multiplications on ties), then the smallest
+// ring whose slot layout and depth agree with each other
+ReductionPlan planReduction(const ReductionPlanInput& input);
+
+// same with a fixed sign approximation; ignores targetError and maxDifference and
+// throws invalid_argument if the comparison kernel cannot evaluate it
+ReductionPlan planReduction(const ReductionPlanInput& input, const SignApproximation& sign);
+
+std::ostream& operator<<(std::ostream& os, const ReductionPlan& plan);
+
+// Level budget when bootstrapping refreshes the running maximum between
+// batches. A batch tournament over fresh records must fit under the levels
+// bootstrapping consumes, which caps the batch size; a refreshed maximum keeps
+// enough levels for one more merge. Neither depth nor ring depends on the
+// gallery size.
+struct BootstrapPlan {
+    uint32_t bootstrapDepth = 0;
+    uint32_t dotDepth = 0;
+    uint32_t mergeDepth = 0;
+    size_t batchSize = 0;
+    size_t batchRounds = 0;
+    uint32_t multDepth = 0;
+    uint32_t ringDim = 0;
+
+    // levels a stored record needs: similarity, batch tournament, merge into the running maximum
+    uint32_t batchDepth() const { return dotDepth + mergeDepth * (uint32_t)(batchRounds + 1); }
+};
+
+// mergeDepth is the comparison kernel's level cost, bootstrapDepth what OpenFHE
+// reports for the level budget; uses input.batchSize as the upper bound
+BootstrapPlan planBootstrappedReduction(const ReductionPlanInput& input, uint32_t mergeDepth, uint32_t bootstrapDepth);
+
+std::ostream& operator<<(std::ostream& os, const BootstrapPlan& plan);
+
+#endif // REDUCTION_PLANNER_H
@@ -0,0 +1,15 @@
+#ifndef RESOURCE_USAGE_H
+#define RESOURCE_USAGE_H
+
+#include <cstddef>
+#include <sys/resource.h>
+
+// high-water mark of the process' resident set, in bytes
+inline size_t peakRssBytes() {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    // Linux reports kilobytes
+    return (size_t)usage.ru_maxrss * 1024;
+}
+
+#endif // RESOURCE_USAGE_H
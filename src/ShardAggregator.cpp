@@ -0,0 +1,232 @@
+#include "ShardAggregator.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <syncstream>
+
+#include <poll.h>
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+// waits until fd is readable; false once a stop was requested or cancelled() holds
+template <typename Cancelled>
+bool waitReadable(int fd, const stop_token& stop, Cancelled&& cancelled) {
+    while (!stop.stop_requested() && !cancelled()) {
+        pollfd pfd{fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, 250);
+        if (rc > 0) return true;
+        if (rc < 0 && errno != EINTR) throw runtime_error("poll() failed");
+    }
+    return false;
+}
+
+} // namespace
+
+ShardRange shardRange(size_t records, size_t index, size_t count) {
+    if (count == 0 || index >= count) throw invalid_argument("Shard index out of range");
+    return {records * index / count, records * (index + 1) / count};
+}
+
+ShardAggregator::ShardAggregator(ThresholdBiometricSystem& system, const string& galleryPath,
+                                 vector<string> workerSockets, size_t piecesPerWorker)
+    : m_system(system), m_workerSockets(move(workerSockets)), m_maxPayload(maxMessagePayload(system.cryptoContext())) {
+    if (m_workerSockets.empty()) throw invalid_argument("The aggregator needs at least one worker socket");
+    if (piecesPerWorker == 0) throw invalid_argument("Pieces per worker must be positive");
+
+    m_gallery = m_system.openGallery(galleryPath);
+    const size_t records = m_gallery->recordCount();
+    const size_t workers = m_workerSockets.size();
+    for (size_t w = 0; w < workers; ++w) {
+        ShardRange home = shardRange(records, w, workers);
+        const size_t homeRecords = home.last - home.first;
+        for (size_t p = 0; p < piecesPerWorker; ++p) {
+            ShardRange piece = shardRange(homeRecords, p, piecesPerWorker);
+            if (piece.first == piece.last) continue;
+            Piece next;
+            next.range = {home.first + piece.first, home.first + piece.last};
+            next.home = w;
+            m_pieces.push_back(move(next));
+        }
+    }
+    m_workerUp.assign(workers, true);
+
+    cout << "* Aggregating " << records << " records over " << workers << " workers in " << m_pieces.size()
+         << " pieces" << endl;
+    for (size_t w = 0; w < workers; ++w) {
+        m_threads.emplace_back([this, w](stop_token stop) { workerLoop(stop, w); });
+    }
+}
+
+ShardAggregator::~ShardAggregator() {
+    for (auto& t : m_threads) t.request_stop();
+    m_cv.notify_all();
+}
+
+Ciphertext<DCRTPoly> ShardAggregator::computeMax(const Ciphertext<DCRTPoly>& encQuery) {
+    auto query = make_shared<const string>(serializeCiphertext(encQuery));
+    auto start = chrono::steady_clock::now();
+
+    unique_lock lock(m_mutex);
+    ++m_generation;
+    m_query = move(query);
+    for (auto& piece : m_pieces) {
+        piece.inFlight = 0;
+        piece.done = false;
+        piece.partial = nullptr;
+    }
+    m_remaining = m_pieces.size();
+    m_backups = 0;
+    m_cancelled = 0;
+    m_failures = 0;
+    m_pieceTimes.clear();
+    m_error.clear();
+    m_active = true;
+    m_cv.notify_all();
+    m_cv.wait(lock, [this] { return m_remaining == 0 || !m_error.empty() || !anyWorkerUp(); });
+    m_active = false;
+
+    if (!m_error.empty()) throw runtime_error("Shard worker error: " + m_error);
+    if (m_remaining > 0) throw runtime_error("No shard worker is reachable");
+    vector<Ciphertext<DCRTPoly>> partials;
+    for (auto& piece : m_pieces) partials.push_back(move(piece.partial));
+    auto gathered = chrono::steady_clock::now();
+    cout << "  - Gathered " << partials.size() << " partial maxima in "
+         << chrono::duration_cast<chrono::milliseconds>(gathered - start).count() << "ms (" << m_backups
+         << " backup runs, " << m_cancelled << " cancelled, " << m_failures << " worker failures)" << endl;
+    lock.unlock();
+
+    return m_system.combineShardMaxima(partials, m_gallery->header().templatesPerRecord);
+}
+
+bool ShardAggregator::pickPiece(size_t worker, size_t& index) const {
+    if (!m_active) return false;
+    // own pieces, then unstarted ones of other workers, then a second run of a straggler
+    const auto now = Clock::now();
+    for (int pass = 0; pass < 3; ++pass) {
+        if (pass == 2 && m_backupDelay == Clock::duration::zero()) break;
+        for (size_t i = 0; i < m_pieces.size(); ++i) {
+            const auto& piece = m_pieces[i];
+            if (piece.done) continue;
+            bool take = pass == 0 ? piece.inFlight == 0 && piece.home == worker
+                      : pass == 1 ? piece.inFlight == 0
+                                  : piece.inFlight == 1 && now - piece.started >= m_backupDelay;
+            if (take) {
+                index = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+ShardAggregator::Clock::time_point ShardAggregator::nextBackupTime() const {
+    // with no piece time known yet, wake up now and then to re-check
+    auto next = Clock::now() + chrono::seconds(1);
+    if (!m_active || m_backupDelay == Clock::duration::zero()) return next;
+    for (const auto& piece : m_pieces) {
+        if (!piece.done && piece.inFlight == 1) next = min(next, piece.started + m_backupDelay);
+    }
+    return next;
+}
+
+void ShardAggregator::recordPieceTime(Clock::duration elapsed) {
+    m_pieceTimes.push_back(elapsed);
+    auto median = m_pieceTimes.begin() + m_pieceTimes.size() / 2;
+    nth_element(m_pieceTimes.begin(), median, m_pieceTimes.end());
+    m_backupDelay = chrono::duration_cast<Clock::duration>(*median * kStragglerFactor);
+}
+
+bool ShardAggregator::anyWorkerUp() const {
+    for (bool up : m_workerUp) {
+        if (up) return true;
+    }
+    return false;
+}
+
+void ShardAggregator::workerLoop(stop_token stop, size_t worker) {
+    const string& socketPath = m_workerSockets[worker];
+    UniqueFd conn;
+    while (!stop.stop_requested()) {
+        unique_lock lock(m_mutex);
+        size_t index = 0;
+        // idle workers wake up when a piece in flight turns into a straggler
+        while (!stop.stop_requested() && !m_cv.wait_until(lock, stop, nextBackupTime(), [&] { return pickPiece(worker, index); })) {
+        }
+        if (stop.stop_requested()) break;
+        const uint64_t generation = m_generation;
+        if (m_pieces[index].inFlight > 0) {
+            ++m_backups;
+        } else {
+            m_pieces[index].started = Clock::now();
+        }
+        ++m_pieces[index].inFlight;
+        const ShardRange range = m_pieces[index].range;
+        auto query = m_query;
+        lock.unlock();
+
+        // the other run of this piece answered first, or a new query reset it
+        auto superseded = [&] {
+            lock_guard guard(m_mutex);
+            return generation != m_generation || m_pieces[index].done;
+        };
+
+        // worker errors are answers (the aggregator reports them); transport errors retry elsewhere
+        Message reply;
+        Ciphertext<DCRTPoly> partial;
+        string failure;
+        bool cancelled = false;
+        try {
+            if (!conn) conn = connectUnix(socketPath);
+            sendMessage(conn.get(), MessageType::ShardQuery, encodeShardQuery(range, *query));
+            if (waitReadable(conn.get(), stop, superseded)) {
+                if (!receiveMessage(conn.get(), reply, m_maxPayload)) throw runtime_error("connection closed");
+                if (reply.type == MessageType::Result) partial = deserializeCiphertext(reply.payload);
+            } else if (stop.stop_requested()) {
+                break;
+            } else {
+                // hanging up tells the worker to skip the piece if it is still queued there
+                conn = UniqueFd();
+                cancelled = true;
+            }
+        } catch (const exception& e) {
+            failure = e.what();
+            conn = UniqueFd();
+        }
+
+        lock.lock();
+        // a straggler answering an earlier query: the piece was reset since
+        if (generation != m_generation) continue;
+        auto& piece = m_pieces[index];
+        --piece.inFlight;
+        if (cancelled) {
+            ++m_cancelled;
+            continue;
+        }
+        if (!failure.empty()) {
+            osyncstream(cerr) << "  - Worker " << socketPath << " failed on records [" << range.first << ", "
+                              << range.last << "): " << failure << endl;
+            ++m_failures;
+            m_workerUp[worker] = false;
+            m_cv.notify_all();
+            // back off before reconnecting; the piece is free for the other workers meanwhile
+            m_cv.wait_for(lock, stop, chrono::seconds(1), [] { return false; });
+            m_workerUp[worker] = true;
+            continue;
+        }
+        if (reply.type != MessageType::Result) {
+            m_error = socketPath + ": " + string(reply.payload.begin(), reply.payload.end());
+        } else if (!piece.done) {
+            piece.done = true;
+            piece.partial = move(partial);
+            --m_remaining;
+            recordPieceTime(Clock::now() - piece.started);
+        }
+        m_cv.notify_all();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef SHARD_AGGREGATOR_H
+#define SHARD_AGGREGATOR_H
+
+#include "GalleryFile.h"
+#include "Protocol.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ThresholdBiometricSystem;
+
+// home records of shard `index` out of `count` over a gallery of `records`
+ShardRange shardRange(size_t records, size_t index, size_t count);
+
+// Scatter/gather over shard workers (`biometric_verify --serve --shard i/N`)
+// on local sockets.
+//
+// Every worker maps the whole gallery, so any record range can go to any
+// worker. Each worker's home shard is split into piecesPerWorker pieces.
+// A worker takes its own pieces first, then steals pieces nobody has started.
+// Once nothing is left unstarted, an idle worker re-runs a piece that has been
+// in flight for kStragglerFactor times the median piece time; the first answer
+// wins and the other run's connection is dropped, so its worker skips the piece
+// if it has not started it yet. A slow or dead worker therefore delays a query
+// by about one piece. The packed partial maxima are merged with the
+// same polyMax tournament, in record order, and folded across blocks.
+class ShardAggregator {
+public:
+    ShardAggregator(ThresholdBiometricSystem& system, const std::string& galleryPath,
+                    std::vector<std::string> workerSockets, size_t piecesPerWorker);
+    ~ShardAggregator();
+
+    // one query at a time
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeMax(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encQuery);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // a piece in flight this much longer than the median piece time gets a backup run
+    static constexpr double kStragglerFactor = 2.0;
+
+    struct Piece {
+        ShardRange range;
+        size_t home;
+        size_t inFlight = 0;
+        bool done = false;
+        Clock::time_point started;   // of the first run
+        lbcrypto::Ciphertext<lbcrypto::DCRTPoly> partial;
+    };
+
+    void workerLoop(std::stop_token stop, size_t worker);
+
+    // next piece for this worker under m_mutex; false if there is nothing to do yet
+    bool pickPiece(size_t worker, size_t& index) const;
+    bool anyWorkerUp() const;
+
+    // when the earliest piece in flight turns into a straggler, under m_mutex
+    Clock::time_point nextBackupTime() const;
+    void recordPieceTime(Clock::duration elapsed);
+
+    ThresholdBiometricSystem& m_system;
+    std::unique_ptr<GalleryReader> m_gallery;
+    std::vector<std::string> m_workerSockets;
+    const uint64_t m_maxPayload;
+
+    std::mutex m_mutex;
+    std::condition_variable_any m_cv;
+    std::vector<Piece> m_pieces;
+    std::vector<bool> m_workerUp;
+    uint64_t m_generation = 0;            // bumped per query; older answers are dropped
+    bool m_active = false;
+    std::shared_ptr<const std::string> m_query;
+    size_t m_remaining = 0;
+    size_t m_backups = 0;
+    size_t m_cancelled = 0;
+    size_t m_failures = 0;
+    std::vector<Clock::duration> m_pieceTimes;   // answered pieces of the current query
+    Clock::duration m_backupDelay{};             // zero until a piece time is known; kept across queries
+    std::string m_error;
+
+    std::vector<std::jthread> m_threads;  // last, so the threads stop before the state above goes away
+};
+
+#endif // SHARD_AGGREGATOR_H
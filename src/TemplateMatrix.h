@@ -0,0 +1,61 @@
+#ifndef TEMPLATE_MATRIX_H
+#define TEMPLATE_MATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <vector>
+
+// Plaintext templates, row-major in one allocation. Every row starts on a
+// cache line and is zero-padded to a whole number of them, so kernels can run
+// full-width vector loops over stride() elements without a scalar tail.
+template <typename T>
+class TemplateMatrix {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    TemplateMatrix() = default;
+
+    TemplateMatrix(size_t rows, size_t dim)
+        : m_rows(rows), m_dim(dim), m_stride((dim * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment / sizeof(T)) {
+        const size_t count = std::max<size_t>(1, m_rows * m_stride);
+        m_data.reset(static_cast<T*>(::operator new[](count * sizeof(T), std::align_val_t(kAlignment))));
+        std::fill_n(m_data.get(), count, T(0));
+    }
+
+    // element-wise conversion, e.g. a float32 copy of float64 templates
+    template <typename U>
+    explicit TemplateMatrix(const TemplateMatrix<U>& other) : TemplateMatrix(other.rows(), other.dim()) {
+        for (size_t i = 0; i < m_rows; ++i) std::ranges::copy(other.row(i), row(i).begin());
+    }
+
+    size_t rows() const { return m_rows; }
+    size_t dim() const { return m_dim; }
+    size_t stride() const { return m_stride; }   // elements from one row start to the next
+    bool empty() const { return m_rows == 0; }
+
+    std::span<T> row(size_t i) { return {m_data.get() + i * m_stride, m_dim}; }
+    std::span<const T> row(size_t i) const { return {m_data.get() + i * m_stride, m_dim}; }
+
+    // padded row, stride() elements long
+    const T* rowData(size_t i) const { return m_data.get() + i * m_stride; }
+
+    std::vector<T> copyRow(size_t i) const {
+        auto r = row(i);
+        return {r.begin(), r.end()};
+    }
+
+private:
+    struct AlignedDelete {
+        void operator()(T* p) const { ::operator delete[](p, std::align_val_t(kAlignment)); }
+    };
+
+    size_t m_rows = 0;
+    size_t m_dim = 0;
+    size_t m_stride = 0;
+    std::unique_ptr<T[], AlignedDelete> m_data;
+};
+
+#endif // TEMPLATE_MATRIX_H
@@ -0,0 +1,92 @@
+#include "TemplateSource.h"
+#include "GalleryFile.h"
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+void normalize(vector<double>& v, const string& where) {
+    double norm = 0.0;
+    for (double x : v) norm += x * x;
+    norm = sqrt(norm);
+    if (!(norm > 1e-10) || !isfinite(norm)) throw runtime_error("Template with zero or invalid norm at " + where);
+    for (double& x : v) x /= norm;
+}
+
+void checkId(uint64_t id, const string& where) {
+    if (!isLiveTemplate(id)) throw runtime_error("Template id must be below 2^63 at " + where);
+}
+
+} // namespace
+
+bool VectorTemplateSource::next(EnrollmentTemplate& out) {
+    if (m_next == m_vectors.rows()) return false;
+    out.id = m_firstId + m_next;
+    auto row = m_vectors.row(m_next++);
+    out.values.assign(row.begin(), row.end());
+    return true;
+}
+
+TemplateFileSource::TemplateFileSource(const string& path, size_t vecDim)
+    : m_path(path), m_vecDim(vecDim),
+      m_csv(path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0),
+      m_in(path, m_csv ? ios::in : ios::in | ios::binary) {
+    if (!m_in) throw runtime_error("Cannot open template file: " + path);
+    if (vecDim == 0) throw invalid_argument("Template dimension must be positive");
+}
+
+bool TemplateFileSource::next(EnrollmentTemplate& out) {
+    return m_csv ? nextCsv(out) : nextBinary(out);
+}
+
+bool TemplateFileSource::nextCsv(EnrollmentTemplate& out) {
+    string line;
+    while (getline(m_in, line)) {
+        ++m_line;
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == string::npos) continue;
+
+        const string where = m_path + ":" + to_string(m_line);
+        const char* p = line.data();
+        const char* end = line.data() + line.size();
+        auto [idEnd, idErr] = from_chars(p, end, out.id);
+        if (idErr != errc() || idEnd == end || *idEnd != ',') throw runtime_error("Expected 'id,' at " + where);
+        checkId(out.id, where);
+        p = idEnd + 1;
+
+        out.values.assign(m_vecDim, 0.0);
+        for (size_t j = 0; j < m_vecDim; ++j) {
+            while (p < end && *p == ' ') ++p;
+            auto [valueEnd, err] = from_chars(p, end, out.values[j]);
+            if (err != errc()) throw runtime_error("Expected " + to_string(m_vecDim) + " values at " + where);
+            p = valueEnd;
+            if (j + 1 < m_vecDim) {
+                if (p == end || *p != ',') throw runtime_error("Expected " + to_string(m_vecDim) + " values at " + where);
+                ++p;
+            }
+        }
+        while (p < end && (*p == ' ' || *p == '\r')) ++p;
+        if (p != end) throw runtime_error("More than " + to_string(m_vecDim) + " values at " + where);
+        normalize(out.values, where);
+        return true;
+    }
+    return false;
+}
+
+bool TemplateFileSource::nextBinary(EnrollmentTemplate& out) {
+    if (!m_in.read(reinterpret_cast<char*>(&out.id), sizeof(out.id))) {
+        if (m_in.gcount() != 0) throw runtime_error("Truncated template record in " + m_path);
+        return false;
+    }
+    const string where = m_path + " record " + to_string(m_line++);
+    checkId(out.id, where);
+    m_buffer.resize(m_vecDim);
+    if (!m_in.read(reinterpret_cast<char*>(m_buffer.data()), m_vecDim * sizeof(float))) {
+        throw runtime_error("Truncated template record in " + m_path);
+    }
+    out.values.assign(m_buffer.begin(), m_buffer.end());
+    normalize(out.values, where);
+    return true;
+}
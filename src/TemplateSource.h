@@ -0,0 +1,60 @@
+#ifndef TEMPLATE_SOURCE_H
+#define TEMPLATE_SOURCE_H
+
+#include "TemplateMatrix.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct EnrollmentTemplate {
+    uint64_t id;
+    std::vector<double> values;   // unit-normalized by the source
+};
+
+// Plaintext templates to enroll, read one at a time.
+class TemplateSource {
+public:
+    virtual ~TemplateSource() = default;
+
+    // false once the source is exhausted
+    virtual bool next(EnrollmentTemplate& out) = 0;
+};
+
+// In-memory templates with ids 0, 1, ... (the demo's generated gallery).
+class VectorTemplateSource : public TemplateSource {
+public:
+    explicit VectorTemplateSource(const TemplateMatrix<double>& vectors, uint64_t firstId = 0)
+        : m_vectors(vectors), m_firstId(firstId) {}
+
+    bool next(EnrollmentTemplate& out) override;
+
+private:
+    const TemplateMatrix<double>& m_vectors;
+    uint64_t m_firstId;
+    size_t m_next = 0;
+};
+
+// Templates from a file, normalized on the way in:
+//   *.csv  one template per line: id,v1,...,vDim ('#' starts a comment line)
+//   other  packed little-endian records: uint64 id, then vecDim float32
+class TemplateFileSource : public TemplateSource {
+public:
+    TemplateFileSource(const std::string& path, size_t vecDim);
+
+    bool next(EnrollmentTemplate& out) override;
+
+private:
+    bool nextCsv(EnrollmentTemplate& out);
+    bool nextBinary(EnrollmentTemplate& out);
+
+    std::string m_path;
+    size_t m_vecDim;
+    bool m_csv;
+    std::ifstream m_in;
+    std::vector<float> m_buffer;
+    size_t m_line = 0;
+};
+
+#endif // TEMPLATE_SOURCE_H
@@ -8,6 +8,27 @@
 #include <stdexcept>
 #include <iomanip>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <syncstream>
+#include <exception>
+#include <filesystem>
+#include <map>
+#include <unordered_set>
+
+#include "BoundedQueue.h"
+#include "CountedEval.h"
+#include "GalleryFile.h"
+#include "KeyStore.h"
+#include "GalleryCache.h"
+#include "Metrics.h"
+#include "OnlineTournament.h"
+#include "PlaintextSimilarity.h"
+#include "Protocol.h"
+#include "ResourceUsage.h"
+#include "TemplateSource.h"
+#include "TournamentReducer.h"
 
 #include "ciphertext-ser.h"
 #include "cryptocontext-ser.h"
@@ -17,35 +38,331 @@
 using namespace lbcrypto;
 using namespace std;
 
+namespace {
+
+size_t nextPowerOfTwo(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+GalleryCompression galleryCompression(const AppConfig& config) {
+    return config.compressGallery ? GalleryCompression::Zstd : GalleryCompression::None;
+}
+
+// OpenFHE's bootstrapping examples: a 59-bit scale keeps its precision close to the 60-bit first modulus
+constexpr uint32_t kBootstrapScalingModBits = 59;
+
+vector<uint32_t> bootstrapLevelBudget(const AppConfig& config) {
+    return {config.bootstrapLevelBudget, config.bootstrapLevelBudget};
+}
+
+} // namespace
+
 ThresholdBiometricSystem::ThresholdBiometricSystem(AppConfig config) : m_config(config) {
-    setupCKKS();
-    generateThresholdKeys();
+    auto start = chrono::steady_clock::now();
+    if (!m_config.keystoreDir.empty() && !m_config.initKeys) {
+        loadKeyStore();
+    } else {
+        setupCKKS();
+        computeGalleryLayout();
+        generateThresholdKeys();
+        if (!m_config.keystoreDir.empty()) saveKeyStore();
+    }
+
+    m_comparison = make_unique<ComparisonKernel>(m_cryptoContext, m_config.maxSign, m_config.comparison);
+    auto cost = m_comparison->cost();
+    cout << "* Comparison kernel: " << ComparisonKernel::name(m_config.comparison) << " (" << cost.levels << " levels, "
+         << (cost.keySwitchesExact ? "" : "~") << cost.keySwitches << " key switches per polyMax)" << endl;
+    if (m_config.galleryAutoLevel || m_config.galleryDropLevels > 0 || m_config.compressGallery) {
+        const size_t templates = max(m_config.numVectors, m_config.galleryCapacity);
+        cout << "* Gallery storage: " << storageDropLevels(templates) << " levels dropped for " << templates
+             << " templates (query circuit needs " << queryCircuitDepth(templates) << " of " << m_config.multDepth << ")"
+             << (m_config.compressGallery ? ", zstd records" : "") << endl;
+    }
+    auto end = chrono::steady_clock::now();
+    cout << "* Cold start took " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms" << endl;
 }
 
+ThresholdBiometricSystem::~ThresholdBiometricSystem() = default;
+
 void ThresholdBiometricSystem::setupCKKS() {
     cout << "Setting up CKKS..." << endl;
 
     CCParams<CryptoContextCKKSRNS> parameters;
 
+    uint32_t plannedRingDim = 0;
+    if (m_config.bootstrap) {
+        if (m_config.decision == DecisionEngine::AnyMatch) {
+            throw runtime_error("Bootstrapping refreshes the running maximum; the any-match count needs no refresh");
+        }
+        if (!m_config.packGallery) throw runtime_error("Bootstrapping needs the packed gallery layout");
+        auto plan = bootstrapPlan();
+        cout << "* Bootstrapping plan (level budget " << m_config.bootstrapLevelBudget << "):\n" << plan << endl;
+        if (plan.batchSize < m_config.batchSize) {
+            cout << "  - Batch size lowered from " << m_config.batchSize << " so a batch fits under bootstrapping" << endl;
+        }
+        m_config.batchSize = plan.batchSize;
+        m_config.multDepth = plan.multDepth;
+        plannedRingDim = plan.ringDim;
+    } else if (m_config.decision == DecisionEngine::AnyMatch) {
+        if (m_config.autoParams) {
+            m_config.multDepth = anyMatchDepth();
+            plannedRingDim = minimumRingDimension(m_config.multDepth, 60, 50);
+            cout << "* Any-match plan: depth " << m_config.multDepth << ", ring dimension " << plannedRingDim << endl;
+        }
+    } else if (m_config.autoParams) {
+        auto plan = planReduction(planInput());
+        cout << "* Reduction plan (target error " << m_config.targetError << " per comparison):\n" << plan << endl;
+        m_config.maxSign = plan.sign;
+        m_config.multDepth = plan.multDepth;
+        plannedRingDim = plan.ringDim;
+    } else {
+        try {
+            auto plan = planReduction(planInput(), m_config.maxSign);
+            cout << "* Reduction needs depth " << plan.multDepth << " (budget " << m_config.multDepth << ")" << endl;
+            if (plan.multDepth > m_config.multDepth) {
+                cout << "  - Warning: merges past the budget fall back to averaging; try --auto-params" << endl;
+            }
+        } catch (const runtime_error& e) {
+            cout << "  - Warning: " << e.what() << endl;
+        }
+    }
+
+    if (m_config.ringDim != 0) plannedRingDim = m_config.ringDim;
+
+    const uint32_t scalingModBits = m_config.bootstrap ? kBootstrapScalingModBits : 50;
     parameters.SetMultiplicativeDepth(m_config.multDepth);
     parameters.SetFirstModSize(60);
-    parameters.SetScalingModSize(50);
-    parameters.SetBatchSize(m_config.batchSize);
+    parameters.SetScalingModSize(scalingModBits);
+    if (m_config.bootstrap) {
+        // the secret distribution bootstrapping depth was computed for
+        parameters.SetSecretKeyDist(UNIFORM_TERNARY);
+    }
+    if (!m_config.packGallery) {
+        // one template per ciphertext: keep the slot count at the template width
+        parameters.SetBatchSize(m_config.batchSize);
+    }
+    if (plannedRingDim != 0) {
+        // OpenFHE rejects the ring if it is not secure for this depth
+        parameters.SetRingDim(plannedRingDim);
+    }
     parameters.SetSecurityLevel(HEStd_128_classic);
     parameters.SetKeySwitchTechnique(HYBRID);
     parameters.SetScalingTechnique(FLEXIBLEAUTO);
 
     m_cryptoContext = GenCryptoContext(parameters);
+    enableFeatures();
+
+    cout << "* CKKS context created" << endl;
+    cout << "  - Ring dimension: " << m_cryptoContext->GetRingDimension() << endl;
+    cout << "  - Multiplicative depth budget: " << m_config.multDepth << endl;
+    cout << "  - Scaling mod size: " << scalingModBits << " bits" << endl;
+}
+
+void ThresholdBiometricSystem::enableFeatures() {
     m_cryptoContext->Enable(PKE);
     m_cryptoContext->Enable(KEYSWITCH);
     m_cryptoContext->Enable(LEVELEDSHE);
     m_cryptoContext->Enable(ADVANCEDSHE);
     m_cryptoContext->Enable(MULTIPARTY);
+    if (m_config.bootstrap) m_cryptoContext->Enable(FHE);
+}
 
-    cout << "* CKKS context created" << endl;
+BootstrapPlan ThresholdBiometricSystem::bootstrapPlan() const {
+    auto input = planInput();
+    input.scalingModBits = kBootstrapScalingModBits;
+    const uint32_t mergeDepth = ComparisonKernel::levels(m_config.maxSign, m_config.comparison);
+    const uint32_t bootstrapDepth = FHECKKSRNS::GetBootstrapDepth(bootstrapLevelBudget(m_config), UNIFORM_TERNARY);
+    return planBootstrappedReduction(input, mergeDepth, bootstrapDepth);
+}
+
+void ThresholdBiometricSystem::setupBootstrapping() {
+    auto start = chrono::steady_clock::now();
+    m_cryptoContext->EvalBootstrapSetup(bootstrapLevelBudget(m_config), {0, 0}, (uint32_t)m_layout.slotCount);
+    auto end = chrono::steady_clock::now();
+    cout << "* Bootstrapping precomputed for " << m_layout.slotCount << " slots (took "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms)" << endl;
+}
+
+void ThresholdBiometricSystem::saveKeyStore() {
+    cout << "\nSaving keys to " << m_config.keystoreDir << "..." << endl;
+    KeyStoreManifest manifest;
+    manifest.multDepth = m_config.multDepth;
+    manifest.vecDim = m_config.vecDim;
+    manifest.batchSize = m_config.batchSize;
+    manifest.packGallery = m_config.packGallery;
+    manifest.rotationRadix = m_config.rotationRadix;
+    manifest.numParties = m_config.numParties;
+    manifest.ringDim = m_cryptoContext->GetRingDimension();
+    manifest.signDegree = m_config.maxSign.degree;
+    manifest.signIterations = m_config.maxSign.iterations;
+    manifest.signInputScale = m_config.maxSign.inputScale;
+    manifest.bootstrap = m_config.bootstrap;
+    manifest.bootstrapLevelBudget = m_config.bootstrap ? m_config.bootstrapLevelBudget : 0;
+    manifest.fingerprint = cryptoFingerprint(m_cryptoContext);
+
+    KeyStore store(m_config.keystoreDir);
+    store.save(m_cryptoContext, m_publicKey, m_simulationSecretKey, m_secretKeyShares, manifest);
+    cout << "* Key store written (" << store.sizeOnDisk() / (1024 * 1024) << " MiB)" << endl;
+}
+
+void ThresholdBiometricSystem::loadKeyStore() {
+    cout << "Loading keys from " << m_config.keystoreDir << "..." << endl;
+    KeyStore store(m_config.keystoreDir);
+    auto manifest = store.loadManifest();
+
+    // keys were generated for a specific depth and slot layout, so those come from the store
+    if (manifest.multDepth != m_config.multDepth || manifest.vecDim != m_config.vecDim ||
+        manifest.packGallery != m_config.packGallery || manifest.rotationRadix != m_config.rotationRadix) {
+        cout << "  - Using key store parameters (depth " << manifest.multDepth << ", " << manifest.vecDim
+             << "D, " << (manifest.packGallery ? "packed" : "single") << ", radix " << manifest.rotationRadix
+             << ") instead of the command line" << endl;
+    }
+    m_config.multDepth = manifest.multDepth;
+    m_config.vecDim = manifest.vecDim;
+    m_config.packGallery = manifest.packGallery;
+    m_config.rotationRadix = manifest.rotationRadix;
+    m_config.numParties = manifest.numParties;
+    if (!manifest.packGallery) m_config.batchSize = manifest.batchSize;
+    // the depth budget was sized for this sign approximation
+    m_config.maxSign = {manifest.signDegree, manifest.signIterations, manifest.signInputScale};
+    if (manifest.bootstrap != m_config.bootstrap) {
+        cout << "  - Key store was generated " << (manifest.bootstrap ? "with" : "without")
+             << " bootstrapping; using that instead of the command line" << endl;
+    }
+    m_config.bootstrap = manifest.bootstrap;
+    if (manifest.bootstrap) {
+        // and with bootstrapping, for this batch size
+        m_config.bootstrapLevelBudget = manifest.bootstrapLevelBudget;
+        m_config.batchSize = manifest.batchSize;
+    }
+
+    m_cryptoContext = store.loadContext();
+    enableFeatures();
+    cout << "* CKKS context loaded" << endl;
     cout << "  - Ring dimension: " << m_cryptoContext->GetRingDimension() << endl;
     cout << "  - Multiplicative depth budget: " << m_config.multDepth << endl;
-    cout << "  - Scaling mod size: 50 bits" << endl;
+
+    computeGalleryLayout();
+
+    m_publicKey = store.loadPublicKey();
+    m_simulationSecretKey = store.loadSimulationSecretKey();
+    m_secretKeyShares = store.loadShares(m_config.numParties);
+    m_keyStore = make_unique<KeyStore>(store);
+    cout << "* Keys loaded (evaluation keys deferred until first use)" << endl;
+}
+
+void ThresholdBiometricSystem::ensureEvalKeys() {
+    call_once(m_evalKeysOnce, [this] {
+        if (!m_keyStore) return;
+        auto start = chrono::steady_clock::now();
+        m_keyStore->loadEvalKeys(m_cryptoContext);
+        auto end = chrono::steady_clock::now();
+        cout << "* Evaluation keys loaded (took "
+             << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms)" << endl;
+        if (m_config.bootstrap) setupBootstrapping();
+    });
+}
+
+void ThresholdBiometricSystem::computeGalleryLayout() {
+    m_layout.slotCount = m_cryptoContext->GetEncodingParams()->GetBatchSize();
+
+    if (!m_config.packGallery) {
+        m_layout.blockStride = m_config.vecDim;
+        m_layout.maxTemplatesPerCiphertext = 1;
+        m_layout.templatesPerCiphertext = 1;
+        m_layout.numCiphertexts = m_config.numVectors;
+        m_dotEngine = make_unique<DotProductEngine>(m_cryptoContext, m_layout.blockStride, m_config.rotationRadix);
+        return;
+    }
+
+    // blocks must start on a power-of-two stride so the rotate-and-sum stays block-local
+    m_layout.blockStride = nextPowerOfTwo(m_config.vecDim);
+    if (m_layout.blockStride > m_layout.slotCount) {
+        throw runtime_error("Vector dimension " + to_string(m_config.vecDim) +
+                            " does not fit in " + to_string(m_layout.slotCount) + " slots");
+    }
+
+    // no point in reserving more blocks than there are templates
+    m_layout.maxTemplatesPerCiphertext = m_layout.slotCount / m_layout.blockStride;
+    m_layout.templatesPerCiphertext = min(m_layout.maxTemplatesPerCiphertext,
+                                          nextPowerOfTwo(max<size_t>(m_config.numVectors, 1)));
+    m_layout.numCiphertexts = (m_config.numVectors + m_layout.templatesPerCiphertext - 1) / m_layout.templatesPerCiphertext;
+
+    // after the block-local sum only the first slot of each block holds a score,
+    // the rest are partial sums that would blow up inside polyMax.
+    // Query and mask span every block so galleries packed at any density can be scored.
+    vector<double> mask(m_layout.maxTemplatesPerCiphertext * m_layout.blockStride, 0.0);
+    for (size_t b = 0; b < m_layout.maxTemplatesPerCiphertext; ++b) {
+        mask[b * m_layout.blockStride] = 1.0;
+    }
+    m_blockMask = m_cryptoContext->MakeCKKSPackedPlaintext(mask);
+    m_dotEngine = make_unique<DotProductEngine>(m_cryptoContext, m_layout.blockStride, m_config.rotationRadix,
+                                                m_layout.maxTemplatesPerCiphertext > 1 ? m_blockMask : nullptr);
+
+    cout << "* Packed gallery layout: " << m_layout.templatesPerCiphertext << " templates x "
+         << m_layout.blockStride << " slots per ciphertext (" << m_layout.numCiphertexts
+         << " ciphertexts for " << m_config.numVectors << " templates)" << endl;
+}
+
+uint32_t ThresholdBiometricSystem::queryCircuitDepth() const {
+    return queryCircuitDepth(m_config.numVectors);
+}
+
+uint32_t ThresholdBiometricSystem::queryCircuitDepth(size_t templates) const {
+    if (m_config.decision == DecisionEngine::AnyMatch) return anyMatchDepth();
+    // everything past the first merge into the running maximum runs on refreshed ciphertexts
+    if (m_config.bootstrap) return bootstrapPlan().batchDepth();
+    auto input = planInput();
+    input.numVectors = templates;
+    try {
+        return planReduction(input, m_config.maxSign).multDepth;
+    } catch (const runtime_error&) {
+        // no plan fits the budget: nothing to spare
+        return m_config.multDepth;
+    }
+}
+
+uint32_t ThresholdBiometricSystem::storageDropLevels(size_t templates) const {
+    templates = max(templates, m_config.galleryCapacity);
+    const uint32_t need = queryCircuitDepth(templates);
+    const uint32_t spare = need < m_config.multDepth ? m_config.multDepth - need : 0;
+    if (m_config.galleryAutoLevel) return spare;
+    // the similarity alone needs two levels
+    if (m_config.galleryDropLevels + 2 > m_config.multDepth) {
+        throw runtime_error("Dropping " + to_string(m_config.galleryDropLevels) + " gallery levels leaves no room "
+                            "for the similarity at depth " + to_string(m_config.multDepth));
+    }
+    requireStoredLevels(m_config.galleryDropLevels, templates, "the new gallery");
+    return m_config.galleryDropLevels;
+}
+
+void ThresholdBiometricSystem::requireStoredLevels(uint32_t droppedLevels, size_t templates, const string& gallery) const {
+    // a gallery stored at full level only falls back to averaging past the budget
+    if (droppedLevels == 0) return;
+    const uint32_t need = queryCircuitDepth(templates);
+    if (need + droppedLevels > m_config.multDepth) {
+        throw runtime_error("Records of " + gallery + " are " + to_string(droppedLevels) + " levels below a fresh "
+                            "encryption, but a query over " + to_string(templates) + " templates needs " +
+                            to_string(need) + " of the " + to_string(m_config.multDepth) + " levels");
+    }
+}
+
+void ThresholdBiometricSystem::setGalleryStorage(uint32_t dropLevels, bool compress) {
+    m_config.galleryAutoLevel = false;
+    m_config.galleryDropLevels = dropLevels;
+    m_config.compressGallery = compress;
+    storageDropLevels(m_config.numVectors);
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::reduceForStorage(const Ciphertext<DCRTPoly>& ct, uint32_t dropLevels) const {
+    if (dropLevels == 0) return ct;
+    // the ciphertext keeps its scaling factor, so FLEXIBLEAUTO brings the query down to
+    // this level in the first product; every tower dropped is one less to store and read
+    auto params = dynamic_pointer_cast<CryptoParametersRNS<DCRTPoly>>(m_cryptoContext->GetCryptoParameters());
+    const auto towers = (uint32_t)params->GetElementParams()->GetParams().size();
+    return m_cryptoContext->Compress(ct, towers - dropLevels);
 }
 
 void ThresholdBiometricSystem::generateThresholdKeys() {
@@ -58,12 +375,19 @@ void ThresholdBiometricSystem::generateThresholdKeys() {
     m_cryptoContext->EvalMultKeyGen(mainKP.secretKey);
 
     // gen rotation keys needed for the dot product (summing slots)
-    vector<int> rotationIndices;
-    int maxRotation = min((int)m_config.vecDim, (int)m_cryptoContext->GetRingDimension()/2);
-    for (int r = 1; r < maxRotation; r <<= 1) {
-        rotationIndices.push_back(r);
+    vector<int> rotationIndices = m_dotEngine->rotationIndices();
+    // and for folding the per-block maxima of a packed ciphertext into slot 0
+    for (size_t b = 1; b < m_layout.maxTemplatesPerCiphertext; b <<= 1) {
+        rotationIndices.push_back((int)(b * m_layout.blockStride));
     }
     m_cryptoContext->EvalRotateKeyGen(mainKP.secretKey, rotationIndices);
+    cout << "  - Rotation keys: " << rotationIndices.size() << " (dot product radix " << m_config.rotationRadix << ")" << endl;
+    if (m_config.bootstrap) {
+        // a real deployment runs this key generation among the parties holding the shares
+        setupBootstrapping();
+        m_cryptoContext->EvalBootstrapKeyGen(mainKP.secretKey, (uint32_t)m_layout.slotCount);
+        cout << "  - Bootstrapping keys generated" << endl;
+    }
     
     m_secretKeyShares.clear();
     for (int i = 0; i < m_config.numParties; ++i) {
@@ -79,219 +403,781 @@ void ThresholdBiometricSystem::run() {
     cout << string(60, '=') << endl;
     cout << "Configuration: " << m_config.numVectors << " vectors x " << m_config.vecDim << "D" << endl;
     cout << "Streaming Batch Size: " << m_config.batchSize << endl;
+    if (m_config.numQueries > 1) cout << "Queries per Gallery Pass: " << m_config.numQueries << endl;
+    cout << "Gallery Packing: " << m_layout.templatesPerCiphertext << " templates per ciphertext" << endl;
     cout << "Max Depth: " << m_config.multDepth << endl;
-    cout << "Approach: Polynomial Approximation of Maximum" << endl;
+    if (m_config.bootstrap) cout << "Bootstrapping: running maximum refreshed between batches" << endl;
+    if (m_config.decision == DecisionEngine::AnyMatch) cout << "Decision Depth: " << anyMatchDepth() << endl;
+    const bool anyMatch = m_config.decision == DecisionEngine::AnyMatch;
+    cout << "Approach: " << (anyMatch ? "Sign Approximation Count (any match above threshold)"
+                                      : "Polynomial Approximation of Maximum") << endl;
 
     auto totalStart = chrono::high_resolution_clock::now();
     auto database = generateTestVectors(m_config.numVectors, m_config.vecDim);
-    auto query = generateTestVectors(1, m_config.vecDim)[0];
+    const size_t numQueries = max<size_t>(1, m_config.numQueries);
+    auto queries = generateTestVectors(numQueries, m_config.vecDim);
 
     cout << "\nComputing plaintext baseline..." << endl;
     auto ptStart = chrono::high_resolution_clock::now();
-    double plaintextMax = computePlaintextMaxSimilarity(query, database);
+    auto baseline = scoreTemplates(queries, database, 1, m_config.threshold, m_config.workerThreads);
+    vector<double> plaintextMax;
+    for (const auto& best : baseline.topK) {
+        cout << "  - Max similarity found at index " << best[0].index << endl;
+        plaintextMax.push_back(best[0].score);
+    }
+    const vector<size_t>& plaintextMatches = baseline.aboveThreshold;
     auto ptEnd = chrono::high_resolution_clock::now();
-    cout << "* Plaintext max similarity: " << fixed << setprecision(8) << plaintextMax
+    cout << "* Plaintext max similarity: " << fixed << setprecision(8) << plaintextMax[0]
+         << (numQueries > 1 ? " (query 1)" : "")
          << " (took " << chrono::duration_cast<chrono::milliseconds>(ptEnd - ptStart).count() << "ms)" << endl;
 
     string dbFile = encryptVectorDatabaseToFile(database);
-    auto encQuery = encryptQueryVector(query);
+    vector<Ciphertext<DCRTPoly>> encQueries;
+    for (size_t q = 0; q < queries.rows(); ++q) {
+        encQueries.push_back(encryptQueryVector(queries.copyRow(q)));
+    }
 
-    database.clear();
-    database.shrink_to_fit();
-    query.clear();
-    query.shrink_to_fit();
+    database = {};
+    queries = {};
 
     cout << "\nRunning encrypted pipeline..." << endl;
+    auto gallery = openGallery(dbFile);
     auto encStart = chrono::high_resolution_clock::now();
-    Ciphertext<DCRTPoly> encResult = computeStreamingApproximation(dbFile, encQuery);
+    auto encResults = anyMatch ? computeAnyMatchCounts(*gallery, encQueries)
+                               : computeStreamingApproximations(*gallery, encQueries);
     auto encEnd = chrono::high_resolution_clock::now();
 
-    cout << "* Encrypted pipeline finished (took "
-         << chrono::duration_cast<chrono::seconds>(encEnd - encStart).count() << "s)" << endl;
+    auto encSeconds = chrono::duration_cast<chrono::seconds>(encEnd - encStart).count();
+    cout << "* Encrypted pipeline finished (took " << encSeconds << "s)" << endl;
+    if (numQueries > 1) {
+        cout << "  - " << gallery->recordCount() << " records read once for " << numQueries << " queries ("
+             << gallery->fileSize() / numQueries / 1024 << " KiB read, "
+             << chrono::duration_cast<chrono::milliseconds>(encEnd - encStart).count() / numQueries
+             << "ms per query)" << endl;
+    }
+    gallery.reset();
 
-    double encResultValue = thresholdDecryptResult(encResult);
-    bool isUnique = (encResultValue < m_config.threshold);
+    vector<double> encResultValues;
+    for (const auto& encResult : encResults) {
+        encResultValues.push_back(thresholdDecryptResult(encResult));
+    }
 
-    if (remove(dbFile.c_str()) != 0) {
+    if (m_config.keepGallery) {
+        cout << "* Encrypted gallery kept at " << dbFile << endl;
+    } else if (remove(dbFile.c_str()) != 0) {
         cerr << "Warning: Could not delete temporary file " << dbFile << endl;
     }
 
     auto totalEnd = chrono::high_resolution_clock::now();
 
     cout << "\n" << string(60, '=') << "\nRESULTS\n" << string(60, '=') << endl;
-    cout << "Plaintext Max Similarity:  " << fixed << setprecision(8) << plaintextMax << endl;
-    cout << "Encrypted Result:          " << fixed << setprecision(8) << encResultValue << endl;
-
-    double absErr = fabs(plaintextMax - encResultValue);
-    double relErr = absErr / (fabs(plaintextMax) + 1e-10) * 100;
-    cout << "Absolute Error:            " << scientific << setprecision(4) << absErr << endl;
-    cout << "Relative Error:            " << fixed << setprecision(2) << relErr << "%" << endl;
-    double accuracy = (100.0 - relErr);
-    cout << "Accuracy:                  " << fixed << setprecision(2) << accuracy << "%" << endl;
-
-    cout << "\nFinal Decision: The query vector is " << (isUnique ? "UNIQUE" : "NOT UNIQUE") 
-         << " (Threshold: " << m_config.threshold << ")" << endl;
+    double minAccuracy = 100.0;
+    for (size_t q = 0; q < numQueries; ++q) {
+        if (numQueries > 1) cout << "Query " << (q + 1) << ":" << endl;
+        if (anyMatch) {
+            bool isUnique = encResultValues[q] < 0.5;
+            cout << "Plaintext Matches:         " << plaintextMatches[q] << endl;
+            cout << "Encrypted Match Count:     " << fixed << setprecision(4) << encResultValues[q] << endl;
+            cout << "Count Error:               " << scientific << setprecision(4)
+                 << fabs(encResultValues[q] - (double)plaintextMatches[q]) << endl;
+            cout << "Decision Agrees:           " << (isUnique == (plaintextMatches[q] == 0) ? "yes" : "NO") << endl;
+            if (isUnique != (plaintextMatches[q] == 0)) minAccuracy = 0.0;
+            cout << "\nFinal Decision: The query vector is " << (isUnique ? "UNIQUE" : "NOT UNIQUE")
+                 << " (Threshold: " << m_config.threshold << ")" << endl;
+            continue;
+        }
+        cout << "Plaintext Max Similarity:  " << fixed << setprecision(8) << plaintextMax[q] << endl;
+        cout << "Encrypted Result:          " << fixed << setprecision(8) << encResultValues[q] << endl;
+
+        double absErr = fabs(plaintextMax[q] - encResultValues[q]);
+        double relErr = absErr / (fabs(plaintextMax[q]) + 1e-10) * 100;
+        cout << "Absolute Error:            " << scientific << setprecision(4) << absErr << endl;
+        cout << "Relative Error:            " << fixed << setprecision(2) << relErr << "%" << endl;
+        double accuracy = (100.0 - relErr);
+        cout << "Accuracy:                  " << fixed << setprecision(2) << accuracy << "%" << endl;
+        minAccuracy = min(minAccuracy, accuracy);
+
+        bool isUnique = (encResultValues[q] < m_config.threshold);
+        cout << "\nFinal Decision: The query vector is " << (isUnique ? "UNIQUE" : "NOT UNIQUE")
+             << " (Threshold: " << m_config.threshold << ")" << endl;
+    }
     
+    cout << "Peak RSS: " << peakRssBytes() / (1024 * 1024) << " MiB" << endl;
     cout << "\nTotal runtime: " << chrono::duration_cast<chrono::seconds>(totalEnd - totalStart).count() << "s" << endl;
     cout << string(60, '=') << endl;
     
-    if (accuracy < 90.0) {
-        cout << "\nWARNING: Accuracy is below 90%. Consider adjusting parameters." << endl;
+    if (minAccuracy < 90.0) {
+        cout << "\nWARNING: " << (anyMatch ? "A decision disagrees with the plaintext baseline."
+                                           : "Accuracy is below 90%.") << " Consider adjusting parameters." << endl;
     }
 }
 
-vector<vector<double>> ThresholdBiometricSystem::generateTestVectors(size_t numVectors, size_t dimension) {
+TemplateMatrix<double> ThresholdBiometricSystem::generateTestVectors(size_t numVectors, size_t dimension) {
     cout << "\nGenerating " << numVectors << " unit-normalized " << dimension << "D vectors..." << endl;
-    vector<vector<double>> vecs(numVectors, vector<double>(dimension));
+    TemplateMatrix<double> vecs(numVectors, dimension);
     mt19937 gen(42);
     normal_distribution<double> dist(0.0, 1.0);
 
     for (size_t i = 0; i < numVectors; ++i) {
+        auto v = vecs.row(i);
         double norm = 0.0;
-        for (size_t j = 0; j < dimension; ++j) {
-            vecs[i][j] = dist(gen);
-            norm += vecs[i][j] * vecs[i][j];
+        for (double& x : v) {
+            x = dist(gen);
+            norm += x * x;
         }
         norm = sqrt(norm);
         if (norm < 1e-10) norm = 1.0;
-        for (size_t j = 0; j < dimension; ++j) vecs[i][j] /= norm;
+        for (double& x : v) x /= norm;
     }
     cout << "* Vector generation complete." << endl;
     return vecs;
 }
 
-string ThresholdBiometricSystem::encryptVectorDatabaseToFile(const vector<vector<double>>& vectors) {
+string ThresholdBiometricSystem::encryptVectorDatabaseToFile(const TemplateMatrix<double>& vectors) {
     cout << "\nEncrypting database to file (streaming)..." << endl;
-    const string fname = "encrypted_db.bin";
-    ofstream ofs(fname, ios::binary);
-    if (!ofs) throw runtime_error("Failed to create file: " + fname);
-
-    for (size_t i = 0; i < vectors.size(); ++i) {
-        Plaintext pt = m_cryptoContext->MakeCKKSPackedPlaintext(vectors[i]);
-        auto ct = m_cryptoContext->Encrypt(m_publicKey, pt);
-        Serial::Serialize(ct, ofs, SerType::BINARY);
-        if (!ofs.good()) {
-            throw runtime_error("Serialization failed for vector " + to_string(i));
+    const string& fname = m_config.galleryPath;
+    const size_t perCt = m_layout.templatesPerCiphertext;
+    const size_t blocks = (vectors.rows() + perCt - 1) / perCt * perCt;
+    GalleryWriter writer(fname, m_cryptoContext, m_config.vecDim, m_layout.blockStride, perCt,
+                         storageDropLevels(blocks), galleryCompression(m_config));
+    VectorTemplateSource source(vectors);
+    auto stats = encryptTemplates(source, writer);
+    writer.close();
+    cout << "* Database successfully encrypted to " << fname << " (" << writer.recordCount() << " records, "
+         << writer.bytesWritten() / (1024 * 1024) << " MiB, " << fixed << setprecision(1)
+         << stats.bytesWritten / 1024.0 / stats.templates << " KiB per template, "
+         << stats.templates / stats.seconds << " templates/s)" << endl;
+    return fname;
+}
+
+EnrollmentStats ThresholdBiometricSystem::enrollTemplates(TemplateSource& source, const string& galleryPath, bool append) {
+    cout << "\n" << (append ? "Appending templates to " : "Enrolling templates into ") << galleryPath << "..." << endl;
+    // a new gallery fills whole ciphertexts: its final size is not known up front, so the
+    // auto level is sized for galleryCapacity; an append keeps the level of the gallery
+    if (!append && m_config.galleryAutoLevel && m_config.galleryCapacity == 0) {
+        throw runtime_error("Enrolling with automatic gallery levels needs the capacity to size them for "
+                            "(--gallery-capacity)");
+    }
+    const uint32_t dropLevels = m_config.galleryAutoLevel ? storageDropLevels(m_config.galleryCapacity)
+                                                          : m_config.galleryDropLevels;
+    auto writer = append ? make_unique<GalleryWriter>(galleryPath, m_cryptoContext)
+                         : make_unique<GalleryWriter>(galleryPath, m_cryptoContext, m_config.vecDim,
+                                                      m_layout.blockStride, m_layout.maxTemplatesPerCiphertext,
+                                                      dropLevels, galleryCompression(m_config));
+    validateGalleryLayout(writer->header());
+    const size_t existingRecords = writer->recordCount();
+
+    auto stats = encryptTemplates(source, *writer);
+    if (stats.templates == 0) throw runtime_error("No templates to enroll");
+    // without close() the writer leaves the gallery as it was
+    requireStoredLevels(writer->header().droppedLevels, writer->recordCount() * writer->templatesPerRecord(), galleryPath);
+    writer->close();
+    cout << "* Enrolled " << stats.templates << " templates in " << stats.records << " records after "
+         << existingRecords << " existing (" << stats.bytesWritten / (1024 * 1024) << " MiB written, "
+         << fixed << setprecision(1) << stats.bytesWritten / 1024.0 / stats.templates << " KiB per template, "
+         << stats.seconds << "s, " << stats.templates / stats.seconds << " templates/s on "
+         << max<size_t>(1, m_config.workerThreads) << " threads)" << endl;
+    return stats;
+}
+
+EnrollmentStats ThresholdBiometricSystem::encryptTemplates(TemplateSource& source, GalleryWriter& writer) {
+    StageTimer timer(Stage::EncryptGallery);
+    struct Job {
+        size_t seq;
+        vector<uint64_t> ids;
+        vector<double> packed;
+    };
+    struct Encrypted {
+        size_t seq;
+        string bytes;
+        vector<uint64_t> ids;
+    };
+
+    const size_t perCt = writer.templatesPerRecord();
+    const uint32_t dropLevels = writer.header().droppedLevels;
+    const size_t stride = m_layout.blockStride;
+    const uint64_t startBytes = writer.bytesWritten();
+    auto start = chrono::steady_clock::now();
+
+    // reader -> encryption workers -> writer, which puts records back in source order
+    BoundedQueue<Job> jobs(m_config.queueDepth);
+    BoundedQueue<Encrypted> encrypted(m_config.queueDepth);
+
+    mutex errorMutex;
+    exception_ptr firstError;
+    auto fail = [&](exception_ptr e) {
+        lock_guard lock(errorMutex);
+        if (!firstError) firstError = e;
+        jobs.close();
+        encrypted.close();
+    };
+
+    jthread writerThread([&] {
+        try {
+            map<size_t, Encrypted> pending;
+            size_t next = 0;
+            while (auto record = encrypted.pop()) {
+                pending.emplace(record->seq, move(*record));
+                for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+                    writer.appendStored(it->second.bytes, it->second.ids);
+                    pending.erase(it);
+                }
+            }
+        } catch (...) {
+            fail(current_exception());
         }
+    });
+
+    vector<jthread> workers;
+    for (size_t w = 0; w < max<size_t>(1, m_config.workerThreads); ++w) {
+        workers.emplace_back([&] {
+            try {
+                while (auto job = jobs.pop()) {
+                    Plaintext pt = m_cryptoContext->MakeCKKSPackedPlaintext(job->packed);
+                    auto ct = reduceForStorage(m_cryptoContext->Encrypt(m_publicKey, pt), dropLevels);
+                    // compressing here keeps the in-order writer thread off the critical path
+                    auto stored = writer.encodeRecord(serializeCiphertext(ct));
+                    if (!encrypted.push({job->seq, move(stored), move(job->ids)})) return;
+                }
+            } catch (...) {
+                fail(current_exception());
+            }
+        });
     }
-    cout << "* Database successfully encrypted to " << fname << endl;
-    return fname;
+
+    EnrollmentStats stats;
+    try {
+        unordered_set<uint64_t> enrolled;
+        for (uint64_t id : writer.templateIds()) {
+            if (isLiveTemplate(id)) enrolled.insert(id);
+        }
+        EnrollmentTemplate t;
+        for (bool more = true; more; ) {
+            Job job{stats.records, vector<uint64_t>(perCt, kPaddingTemplate),
+                    vector<double>(perCt == 1 ? m_config.vecDim : perCt * stride, 0.0)};
+            size_t filled = 0;
+            while (filled < perCt && (more = source.next(t))) {
+                if (t.values.size() != m_config.vecDim) {
+                    throw runtime_error("Template " + to_string(t.id) + " has " + to_string(t.values.size()) +
+                                        " values, the gallery stores " + to_string(m_config.vecDim));
+                }
+                if (!enrolled.insert(t.id).second) throw runtime_error("Template id " + to_string(t.id) + " is already enrolled");
+                copy(t.values.begin(), t.values.end(), job.packed.begin() + filled * stride);
+                job.ids[filled++] = t.id;
+            }
+            if (filled == 0) break;
+            // pad unused blocks with a copy of the last real template so they cannot win the max
+            for (size_t b = filled; b < perCt; ++b) {
+                copy_n(job.packed.begin() + (filled - 1) * stride, stride, job.packed.begin() + b * stride);
+            }
+            stats.templates += filled;
+            if (!jobs.push(move(job))) break;
+            if (++stats.records % 1024 == 0) {
+                cout << "  - Queued " << stats.templates << " templates (peak RSS " << peakRssBytes() / (1024 * 1024)
+                     << " MiB)..." << endl;
+            }
+        }
+    } catch (...) {
+        fail(current_exception());
+    }
+    jobs.close();
+    workers.clear();
+    encrypted.close();
+    writerThread.join();
+
+    if (firstError) rethrow_exception(firstError);
+    stats.bytesWritten = writer.bytesWritten() - startBytes;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+size_t ThresholdBiometricSystem::deleteTemplates(const string& galleryPath, const vector<uint64_t>& ids) {
+    size_t marked = tombstoneTemplates(galleryPath, m_cryptoContext, ids);
+    cout << "* Marked " << marked << " of " << ids.size() << " templates deleted in " << galleryPath << endl;
+    return marked;
+}
+
+CompactionStats ThresholdBiometricSystem::compactGallery(const string& galleryPath) {
+    cout << "\nCompacting " << galleryPath << "..." << endl;
+    CompactionStats stats;
+    {
+        auto gallery = openGallery(galleryPath);
+        const auto& h = gallery->header();
+        const size_t blocks = h.templatesPerRecord;
+        stats.recordsBefore = gallery->recordCount();
+
+        // merged records are one level lower than their sources, so the gallery must have one to spare
+        size_t fullRecords = 0;
+        size_t mergedTemplates = 0;
+        for (size_t r = 0; r < gallery->recordCount(); ++r) {
+            auto live = gallery->liveBlocks(r);
+            const size_t liveCount = count(live.begin(), live.end(), true);
+            if (liveCount == blocks) {
+                ++fullRecords;
+            } else {
+                mergedTemplates += liveCount;
+            }
+        }
+        const size_t mergedRecords = (mergedTemplates + blocks - 1) / blocks;
+        const uint32_t droppedLevels = h.droppedLevels + (mergedRecords > 0 ? 1 : 0);
+        requireStoredLevels(droppedLevels, (fullRecords + mergedRecords) * blocks, galleryPath + " after merging");
+
+        // the writer renames its file over the gallery on close; this mapping keeps the old one
+        GalleryWriter writer(galleryPath, m_cryptoContext, h.vecDim, h.blockStride, blocks, droppedLevels,
+                             (GalleryCompression)h.compression);
+
+        // live blocks of partly filled records, gathered until they fill one merged record
+        vector<Ciphertext<DCRTPoly>> sources;
+        vector<BlockMove> moves;
+        vector<uint64_t> mergedIds(blocks, kPaddingTemplate);
+        auto flushMerged = [&] {
+            // padding holds a copy of a live template so it never wins the maximum
+            for (size_t to = moves.size(); to < blocks; ++to) moves.push_back({moves[0].source, moves[0].from, to});
+            writer.append(packBlocks(sources, moves), mergedIds);
+            sources.clear();
+            moves.clear();
+            fill(mergedIds.begin(), mergedIds.end(), kPaddingTemplate);
+        };
+
+        vector<uint64_t> ids(blocks);
+        for (size_t r = 0; r < gallery->recordCount(); ++r) {
+            size_t liveCount = 0;
+            for (size_t b = 0; b < ids.size(); ++b) {
+                ids[b] = gallery->templateId(r, b);
+                if (isLiveTemplate(ids[b])) ++liveCount;
+                if (ids[b] != kPaddingTemplate && !isLiveTemplate(ids[b])) ++stats.templatesRemoved;
+            }
+            if (liveCount == 0) continue;
+            if (liveCount == blocks) {
+                writer.appendStored(gallery->record(r), ids);
+                continue;
+            }
+            // padding may copy a deleted template too, so only live blocks are moved
+            ensureEvalKeys();
+            auto ct = gallery->loadRecord(r);
+            for (size_t b = 0; b < blocks; ++b) {
+                if (!isLiveTemplate(ids[b])) continue;
+                if (sources.empty() || sources.back() != ct) sources.push_back(ct);
+                mergedIds[moves.size()] = ids[b];
+                moves.push_back({sources.size() - 1, b, moves.size()});
+                if (moves.size() == blocks) flushMerged();
+            }
+            ++stats.recordsRewritten;
+        }
+        if (!moves.empty()) flushMerged();
+        if (writer.recordCount() == 0) throw runtime_error("Every template of " + galleryPath + " is deleted");
+        writer.close();
+        stats.recordsAfter = writer.recordCount();
+    }
+    cout << "* Compacted " << stats.recordsBefore << " -> " << stats.recordsAfter << " records ("
+         << stats.templatesRemoved << " templates removed, " << stats.recordsRewritten << " partly filled records merged)" << endl;
+    return stats;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::rotateBlocks(const Ciphertext<DCRTPoly>& ct, size_t blocks) {
+    Ciphertext<DCRTPoly> result = ct;
+    for (size_t b = 1; b < m_layout.maxTemplatesPerCiphertext; b <<= 1) {
+        if (blocks & b) result = countedRotate(m_cryptoContext, result, (int32_t)(b * m_layout.blockStride));
+    }
+    return result;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::packBlocks(const vector<Ciphertext<DCRTPoly>>& sources,
+                                                          const vector<BlockMove>& moves) {
+    const size_t stride = m_layout.blockStride;
+    const size_t blocks = m_layout.maxTemplatesPerCiphertext;
+
+    // a left rotation by (from - to) blocks moves block from onto block to, so all
+    // moves of one source over the same distance share a rotation and a mask
+    map<pair<size_t, size_t>, vector<double>> masks;
+    for (const auto& step : moves) {
+        auto& mask = masks[{step.source, (step.from + blocks - step.to) % blocks}];
+        if (mask.empty()) mask.assign(blocks * stride, 0.0);
+        fill_n(mask.begin() + step.to * stride, stride, 1.0);
+    }
+
+    Ciphertext<DCRTPoly> result;
+    for (const auto& [key, mask] : masks) {
+        const auto& [source, distance] = key;
+        auto moved = m_cryptoContext->EvalMult(rotateBlocks(sources[source], distance),
+                                               m_cryptoContext->MakeCKKSPackedPlaintext(mask));
+        result = result ? m_cryptoContext->EvalAdd(result, moved) : moved;
+    }
+    return result;
 }
 
 Ciphertext<DCRTPoly> ThresholdBiometricSystem::encryptQueryVector(const vector<double>& q) {
     cout << "\nEncrypting query vector..." << endl;
-    Plaintext pt = m_cryptoContext->MakeCKKSPackedPlaintext(q);
+    // replicate the query into every block so it lines up with each packed template
+    vector<double> replicated(m_layout.maxTemplatesPerCiphertext == 1 ? q.size()
+                              : m_layout.maxTemplatesPerCiphertext * m_layout.blockStride, 0.0);
+    for (size_t b = 0; b < m_layout.maxTemplatesPerCiphertext; ++b) {
+        copy(q.begin(), q.end(), replicated.begin() + b * m_layout.blockStride);
+    }
+    Plaintext pt = m_cryptoContext->MakeCKKSPackedPlaintext(replicated);
     auto ct = m_cryptoContext->Encrypt(m_publicKey, pt);
     cout << "* Query encrypted (level: " << ct->GetLevel() << ")" << endl;
     return ct;
 }
 
 Ciphertext<DCRTPoly> ThresholdBiometricSystem::computeCosineSimilarity(const Ciphertext<DCRTPoly>& query, const Ciphertext<DCRTPoly>& dbvec) {
-    // element-wise multiplication
-    auto prod = m_cryptoContext->EvalMult(query, dbvec);
-    
-    // sum all slots using rotation and addition
-    Ciphertext<DCRTPoly> sum = prod;
-    int maxRotation = min((int)m_config.vecDim, (int)m_cryptoContext->GetRingDimension()/2);
-    
-    for (int r = 1; r < maxRotation; r <<= 1) {
-        auto rotated = m_cryptoContext->EvalRotate(sum, r);
-        sum = m_cryptoContext->EvalAdd(sum, rotated);
+    StageTimer timer(Stage::Similarity);
+    return m_dotEngine->dot(query, dbvec);
+}
+
+unique_ptr<GalleryReader> ThresholdBiometricSystem::openGallery(const string& path) const {
+    auto gallery = make_unique<GalleryReader>(path, m_cryptoContext);
+    validateGalleryLayout(gallery->header());
+    if (gallery->recordCount() == 0) throw runtime_error("Cannot process an empty batch.");
+    requireStoredLevels(gallery->header().droppedLevels, gallery->recordCount() * gallery->header().templatesPerRecord, path);
+    return gallery;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::computeStreamingApproximation(const GalleryReader& gallery, const Ciphertext<DCRTPoly>& encQuery) {
+    return computeStreamingApproximations(gallery, {encQuery}).front();
+}
+
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeStreamingApproximations(const GalleryReader& gallery,
+                                                                                     const vector<Ciphertext<DCRTPoly>>& encQueries) {
+    if (encQueries.empty()) throw invalid_argument("At least one query is required");
+    cout << "\nComputing maximum similarity via poly approximation";
+    if (encQueries.size() > 1) cout << " for " << encQueries.size() << " queries";
+    cout << "..." << endl;
+    m_averagedMerges = 0;
+    m_bootstraps = 0;
+    auto packedMax = computeGalleryMax(gallery, 0, gallery.recordCount(), encQueries);
+    for (auto& ct : packedMax) {
+        ct = reduceAcrossBlocks(ct, gallery.header().templatesPerRecord);
+    }
+    if (m_averagedMerges > 0) {
+        cout << "  - Warning: " << m_averagedMerges << " merges ran out of depth and averaged instead; try --auto-params" << endl;
     }
-    return sum;
+    if (m_bootstraps > 0) cout << "  - " << m_bootstraps << " ciphertexts refreshed by bootstrapping" << endl;
+    return packedMax;
 }
 
-Ciphertext<DCRTPoly> ThresholdBiometricSystem::computeStreamingApproximation(const string& dbFilePath, const Ciphertext<DCRTPoly>& encQuery) {
-    cout << "\nComputing maximum similarity via poly approximation..." << endl;
-    ifstream ifs(dbFilePath, ios::binary);
-    if (!ifs) throw runtime_error("Cannot open database file: " + dbFilePath);
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::computeShardMax(const GalleryReader& gallery, size_t first, size_t last,
+                                                             const Ciphertext<DCRTPoly>& encQuery) {
+    cout << "\nComputing maximum similarity of records [" << first << ", " << last << ")..." << endl;
+    m_averagedMerges = 0;
+    auto partial = computeGalleryMax(gallery, first, last, {encQuery}).front();
+    if (m_averagedMerges > 0) {
+        cout << "  - Warning: " << m_averagedMerges << " merges ran out of depth and averaged instead" << endl;
+    }
+    return partial;
+}
 
-    Ciphertext<DCRTPoly> globalMax = nullptr;
-    vector<Ciphertext<DCRTPoly>> batchSims;
-    batchSims.reserve(m_config.batchSize);
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::combineShardMaxima(const vector<Ciphertext<DCRTPoly>>& partials,
+                                                                size_t templatesPerRecord) {
+    if (partials.empty()) throw invalid_argument("At least one shard maximum is required");
+    ensureEvalKeys();
+    m_averagedMerges = 0;
+    OnlineTournament tournament([this](const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) {
+        return tournamentMerge(a, b);
+    }, partials.size());
+    for (const auto& partial : partials) tournament.push(partial);
+    auto result = reduceAcrossBlocks(tournament.finish(), templatesPerRecord);
+    if (m_averagedMerges > 0) {
+        cout << "  - Warning: " << m_averagedMerges << " merges ran out of depth and averaged instead" << endl;
+    }
+    return result;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::loadGalleryRecord(const GalleryReader& gallery, size_t index) const {
+    if (m_galleryCache) {
+        if (auto ct = m_galleryCache->get(index)) return ct;
+    }
+    gallery.prefetch(index + 1);
+    return gallery.loadRecord(index);
+}
+
+void ThresholdBiometricSystem::validateGalleryLayout(const GalleryHeader& h) const {
+    if (h.vecDim != m_config.vecDim || h.blockStride != m_layout.blockStride ||
+        h.templatesPerRecord > m_layout.maxTemplatesPerCiphertext) {
+        throw runtime_error("Gallery layout (" + to_string(h.vecDim) + "D, stride " + to_string(h.blockStride) +
+                            ", " + to_string(h.templatesPerRecord) + " per record) does not match the current configuration");
+    }
+}
+
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeGalleryMax(const GalleryReader& gallery, size_t first, size_t last,
+                                                                       const vector<Ciphertext<DCRTPoly>>& encQueries) {
+    StreamReduction reduction{
+        [this](const Ciphertext<DCRTPoly>& query, const Ciphertext<DCRTPoly>& record, size_t) {
+            return computeCosineSimilarity(query, record);
+        },
+        [this](const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) { return tournamentMerge(a, b); },
+        // batch maxima are chained with a plain polyMax; when bootstrapping, the running
+        // maximum is refreshed after each merge so the next batch can merge into it
+        [this](const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) { return refreshForMerge(polyMax(a, b)); },
+    };
+    return computeGalleryReduction(gallery, first, last, encQueries, reduction);
+}
+
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeGalleryReduction(const GalleryReader& gallery, size_t first, size_t last,
+                                                                             const vector<Ciphertext<DCRTPoly>>& encQueries,
+                                                                             const StreamReduction& reduction) {
+    if (first >= last || last > gallery.recordCount()) {
+        throw out_of_range("Invalid gallery record range [" + to_string(first) + ", " + to_string(last) + ")");
+    }
+    ensureEvalKeys();
+    return m_config.workerThreads > 1 || m_config.readerThreads > 1
+        ? computeStreamingPipelined(gallery, first, last, encQueries, reduction)
+        : computeStreamingSerial(gallery, first, last, encQueries, reduction);
+}
+
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeStreamingSerial(const GalleryReader& gallery, size_t first, size_t last,
+                                                                            const vector<Ciphertext<DCRTPoly>>& encQueries,
+                                                                            const StreamReduction& reduction) {
+    const size_t numQueries = encQueries.size();
+    vector<Ciphertext<DCRTPoly>> globalMax(numQueries);
+    // each query merges its similarities on arrival, keeping ~log2(batchSize) ciphertexts alive
+    vector<OnlineTournament> batches;
+    batches.reserve(numQueries);
+    for (size_t q = 0; q < numQueries; ++q) batches.emplace_back(reduction.pairMerge, m_config.batchSize);
 
     size_t count = 0;
     size_t numBatches = 0;
 
-    while (ifs.peek() != EOF) {
-        Ciphertext<DCRTPoly> ct;
-        Serial::Deserialize(ct, ifs, SerType::BINARY);
-        if (ifs.fail()) break;
+    for (size_t i = first; i < last; ++i) {
+        auto ct = loadGalleryRecord(gallery, i);
 
-        auto sim = computeCosineSimilarity(encQuery, ct);
-        batchSims.push_back(move(sim));
+        // score the record against every query before it is dropped
+        for (size_t q = 0; q < numQueries; ++q) {
+            batches[q].push(reduction.score(encQueries[q], ct, i));
+        }
         count++;
 
-        if (batchSims.size() == m_config.batchSize || ifs.peek() == EOF) {
-            auto batchMax = computeBatchApproximation(batchSims);
-            numBatches++;
-            
-            if (globalMax == nullptr) {
-                globalMax = batchMax;
-            } else {
-                globalMax = polyMax(globalMax, batchMax);
+        if (batches[0].size() == m_config.batchSize || i + 1 == last) {
+            for (size_t q = 0; q < numQueries; ++q) {
+                auto batchMax = batches[q].finish();
+                if (globalMax[q] == nullptr) {
+                    globalMax[q] = batchMax;
+                } else {
+                    globalMax[q] = reduction.chainMerge(globalMax[q], batchMax);
+                }
             }
-            batchSims.clear();
+            numBatches++;
             
             if (count % 10 == 0) {
-                cout << "  - Processed " << count << " vectors..." << endl;
+                cout << "  - Processed " << count << " vectors (peak RSS " << peakRssBytes() / (1024 * 1024) << " MiB)..." << endl;
             }
         }
     }
 
-    cout << "* Computation complete. Processed " << count << " vectors in " << numBatches << " batches." << endl;
+    cout << "* Computation complete. Processed " << count << " ciphertexts in " << numBatches << " batches." << endl;
     return globalMax;
 }
 
-Ciphertext<DCRTPoly> ThresholdBiometricSystem::computeBatchApproximation(vector<Ciphertext<DCRTPoly>>& sims) {
-    if (sims.empty()) throw runtime_error("Cannot process an empty batch.");
-    
-    // tournament-style reduction with poly max approximation
-    while (sims.size() > 1) {
-        vector<Ciphertext<DCRTPoly>> nextLevel;
-        for (size_t i = 0; i < sims.size(); i += 2) {
-            if (i + 1 < sims.size()) {
-                if (sims[i]->GetLevel() >= m_config.multDepth - 3) {
-                    // fall back to simple average if running out of depth
-                    nextLevel.push_back(pureAverage(sims[i], sims[i+1]));
-                } else {
-                    nextLevel.push_back(polyMax(sims[i], sims[i+1]));
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeStreamingPipelined(const GalleryReader& gallery, size_t first, size_t last,
+                                                                               const vector<Ciphertext<DCRTPoly>>& encQueries,
+                                                                               const StreamReduction& reduction) {
+    struct Job {
+        size_t seq;
+        Ciphertext<DCRTPoly> ct;
+    };
+
+    // readers -> workers; the reducer merges partial maxima on the worker threads
+    BoundedQueue<Job> jobs(m_config.queueDepth);
+    // one reducer per query, all fed from the same record stream
+    vector<unique_ptr<TournamentReducer>> reducers;
+    for (size_t q = 0; q < encQueries.size(); ++q) {
+        // same merges as the serial path, so the results match it exactly
+        reducers.push_back(make_unique<TournamentReducer>(m_config.batchSize, reduction.pairMerge, reduction.chainMerge));
+    }
+
+    mutex errorMutex;
+    exception_ptr firstError;
+    auto fail = [&](exception_ptr e) {
+        lock_guard lock(errorMutex);
+        if (!firstError) firstError = e;
+        jobs.close();
+    };
+
+    atomic<size_t> processed = 0;
+    vector<jthread> workers;
+    for (size_t w = 0; w < m_config.workerThreads; ++w) {
+        workers.emplace_back([&] {
+            try {
+                while (auto job = jobs.pop()) {
+                    for (size_t q = 0; q < encQueries.size(); ++q) {
+                        reducers[q]->submit(job->seq, reduction.score(encQueries[q], job->ct, first + job->seq));
+                    }
+                    job->ct.reset();
+                    size_t done = ++processed;
+                    if (done % m_config.batchSize == 0) {
+                        osyncstream(cout) << "  - Processed " << done << " ciphertexts..." << endl;
+                    }
                 }
-            } else {
-                nextLevel.push_back(sims[i]);
+            } catch (...) {
+                fail(current_exception());
             }
+        });
+    }
+
+    // readers interleave records so the queue stays close to stream order
+    const size_t numReaders = max<size_t>(1, m_config.readerThreads);
+    vector<jthread> readers;
+    for (size_t r = 0; r < numReaders; ++r) {
+        readers.emplace_back([&, r] {
+            try {
+                for (size_t i = first + r; i < last; i += numReaders) {
+                    if (!jobs.push({i - first, loadGalleryRecord(gallery, i)})) return;
+                }
+            } catch (...) {
+                fail(current_exception());
+            }
+        });
+    }
+    readers.clear();
+    jobs.close();
+    workers.clear();
+
+    if (firstError) rethrow_exception(firstError);
+    size_t count = last - first;
+    vector<Ciphertext<DCRTPoly>> globalMax;
+    for (auto& reducer : reducers) {
+        reducer->finish(count);
+        globalMax.push_back(reducer->result());
+    }
+    cout << "* Computation complete. Processed " << count << " ciphertexts in " << reducers.front()->batchCount()
+         << " batches on " << numReaders << " reader / " << m_config.workerThreads << " worker threads." << endl;
+    return globalMax;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::reduceAcrossBlocks(const Ciphertext<DCRTPoly>& packedMax, size_t templatesPerRecord) {
+    // slot-wise maxima of a packed ciphertext still hold one candidate per block;
+    // fold them into slot 0 with the same tournament used between ciphertexts
+    Ciphertext<DCRTPoly> result = packedMax;
+    for (size_t b = 1; b < templatesPerRecord; b <<= 1) {
+        // both operands of the merge come from result, so one refresh covers them
+        result = refreshForMerge(result);
+        auto rotated = countedRotate(m_cryptoContext, result, (int32_t)(b * m_layout.blockStride));
+        result = tournamentMerge(result, rotated);
+    }
+    return result;
+}
+
+vector<Ciphertext<DCRTPoly>> ThresholdBiometricSystem::computeAnyMatchCounts(const GalleryReader& gallery,
+                                                                           const vector<Ciphertext<DCRTPoly>>& encQueries) {
+    if (encQueries.empty()) throw invalid_argument("At least one query is required");
+    if (m_config.multDepth < anyMatchDepth()) {
+        throw runtime_error("Any-match decision needs multiplicative depth " + to_string(anyMatchDepth()) +
+                            ", context has " + to_string(m_config.multDepth));
+    }
+    cout << "\nCounting similarities above " << m_config.threshold << " via sign approximation..." << endl;
+
+    const auto& h = gallery.header();
+    // padding blocks repeat a real template and deleted ones must not count, so each
+    // record is masked to its live blocks; almost all records share the full mask
+    map<vector<bool>, size_t> patterns;
+    vector<Plaintext> masks;
+    vector<size_t> recordMask(h.recordCount);
+    for (size_t r = 0; r < h.recordCount; ++r) {
+        auto live = gallery.liveBlocks(r);
+        auto [it, inserted] = patterns.emplace(live, masks.size());
+        if (inserted) masks.push_back(makeHalfBlockMask(live));
+        recordMask[r] = it->second;
+    }
+
+    auto add = [this](const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) { return m_cryptoContext->EvalAdd(a, b); };
+    StreamReduction reduction{
+        [&](const Ciphertext<DCRTPoly>& query, const Ciphertext<DCRTPoly>& record, size_t index) {
+            return stepAboveThreshold(computeCosineSimilarity(query, record), masks[recordMask[index]]);
+        },
+        add,
+        add,
+    };
+    auto counts = computeGalleryReduction(gallery, 0, gallery.recordCount(), encQueries, reduction);
+    for (auto& ct : counts) {
+        ct = sumAcrossBlocks(ct, h.templatesPerRecord);
+    }
+    return counts;
+}
+
+uint32_t ThresholdBiometricSystem::anyMatchDepth() const {
+    // similarity product and block mask (single mode skips the mask but budget it anyway),
+    // degree-7 sign iterations with the input scaling folded in, and the step/validity mask
+    return 2 + (uint32_t)m_config.signIterations * signPolynomialDepth(7) + 1;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::stepAboveThreshold(const Ciphertext<DCRTPoly>& sim, const Plaintext& halfMask) {
+    StageTimer timer(Stage::AnyMatchStep);
+    // map sim in [-1, 1] to x = (sim - t) / (1 + t) in [-1, 1) so the sign polynomial stays bounded;
+    // the 1 / (1 + t) is folded into the first iteration's coefficients instead of costing a level
+    const double t = m_config.threshold;
+    auto x = m_cryptoContext->EvalSub(sim, t);
+
+    // f(x) = (35x - 35x^3 + 21x^5 - 5x^7) / 16 maps [-1, 1] to itself and pushes every
+    // point towards +-1; composing it sharpens the step without a deep high-degree polynomial.
+    // The explicit evaluator takes 3 levels per iteration where EvalPoly takes 4.
+    for (size_t i = 0; i < m_config.signIterations; ++i) {
+        auto c = signPolynomial(7);
+        if (i == 0) {
+            for (size_t k = 0; k < c.size(); ++k) c[k] *= pow(1.0 / (1.0 + t), (double)k);
         }
-        sims = move(nextLevel);
+        x = evalOddPolynomial(m_cryptoContext, x, c);
     }
-    return sims[0];
+
+    // (1 + sign) / 2 on the valid block-start slots, zero elsewhere
+    auto step = m_cryptoContext->EvalAdd(m_cryptoContext->EvalMult(x, halfMask), halfMask);
+    countLevelsConsumed(step, sim);
+    return step;
 }
 
-Ciphertext<DCRTPoly> ThresholdBiometricSystem::homomorphicSign(const Ciphertext<DCRTPoly>& x) {
-    // simple polynomial approximation for sign function: sign(x) ~ 1.5x - 0.5x^3
-    // degree-3 polynomial approximation
-    auto x_cubed = m_cryptoContext->EvalMult(m_cryptoContext->EvalMult(x, x), x);
-    auto term1 = m_cryptoContext->EvalMult(x, 1.5);
-    auto term2 = m_cryptoContext->EvalMult(x_cubed, -0.5);
-    return m_cryptoContext->EvalAdd(term1, term2);
+Plaintext ThresholdBiometricSystem::makeHalfBlockMask(const vector<bool>& live) {
+    vector<double> mask(m_layout.maxTemplatesPerCiphertext == 1 ? 1 : live.size() * m_layout.blockStride, 0.0);
+    for (size_t b = 0; b < live.size(); ++b) {
+        if (live[b]) mask[b * m_layout.blockStride] = 0.5;
+    }
+    return m_cryptoContext->MakeCKKSPackedPlaintext(mask);
 }
 
-Ciphertext<DCRTPoly> ThresholdBiometricSystem::polyMax(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) {
-    auto diff = m_cryptoContext->EvalSub(a, b);
-    auto sign_of_diff = homomorphicSign(diff);
-    auto term1 = m_cryptoContext->EvalAdd(a, b);
-    auto term2 = m_cryptoContext->EvalMult(sign_of_diff, diff);
-    auto sum = m_cryptoContext->EvalAdd(term1, term2);
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::sumAcrossBlocks(const Ciphertext<DCRTPoly>& packed, size_t templatesPerRecord) {
+    Ciphertext<DCRTPoly> result = packed;
+    for (size_t b = 1; b < templatesPerRecord; b <<= 1) {
+        result = m_cryptoContext->EvalAdd(result, countedRotate(m_cryptoContext, result, (int32_t)(b * m_layout.blockStride)));
+    }
+    return result;
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::tournamentMerge(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) {
+    StageTimer timer(Stage::Merge);
+    Ciphertext<DCRTPoly> merged;
+    if (max(levelsConsumed(a), levelsConsumed(b)) + m_comparison->cost().levels <= m_config.multDepth) {
+        merged = polyMax(a, b);
+    } else if (m_config.bootstrap) {
+        merged = polyMax(refreshForMerge(a), refreshForMerge(b));
+    } else {
+        // fall back to simple average if running out of depth
+        ++m_averagedMerges;
+        Metrics::add(Counter::AveragedMerge);
+        merged = pureAverage(a, b);
+    }
+    if (Metrics::enabled()) Metrics::recordLevel(levelsConsumed(merged));
+    return merged;
+}
 
-    return m_cryptoContext->EvalMult(sum, 0.5); //rescale
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::refreshForMerge(const Ciphertext<DCRTPoly>& ct) {
+    if (!m_config.bootstrap || levelsConsumed(ct) + m_comparison->cost().levels <= m_config.multDepth) return ct;
+    StageTimer timer(Stage::Bootstrap);
+    ++m_bootstraps;
+    Metrics::add(Counter::Bootstrap);
+    return m_cryptoContext->EvalBootstrap(ct);
+}
+
+Ciphertext<DCRTPoly> ThresholdBiometricSystem::polyMax(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) {
+    return m_comparison->max(a, b);
 }
 
 Ciphertext<DCRTPoly> ThresholdBiometricSystem::pureAverage(const Ciphertext<DCRTPoly>& a, const Ciphertext<DCRTPoly>& b) {
-    auto sum = m_cryptoContext->EvalAdd(a, b);
-    return m_cryptoContext->EvalMult(sum, 0.5);
+    auto average = m_cryptoContext->EvalMult(m_cryptoContext->EvalAdd(a, b), 0.5);
+    countLevelsConsumed(average, a, b);
+    return average;
 }
 
 double ThresholdBiometricSystem::thresholdDecryptResult(const Ciphertext<DCRTPoly>& encryptedResult) {
     cout << "\nSimulating threshold decryption..." << endl;
+    StageTimer timer(Stage::Decrypt);
     cout << "Final ciphertext level: " << encryptedResult->GetLevel() << "/" << m_config.multDepth << endl;
     
     Plaintext pt;
@@ -317,19 +1203,15 @@ bool ThresholdBiometricSystem::computeThresholdDecision(const Ciphertext<DCRTPol
     return isUnique;
 }
 
-double ThresholdBiometricSystem::computePlaintextMaxSimilarity(const vector<double>& q, const vector<vector<double>>& db) {
-    double maxSim = -2.0;
-    size_t maxIndex = 0;
-    for (size_t idx = 0; idx < db.size(); ++idx) {
-        double sim = 0.0;
-        for (size_t i = 0; i < q.size(); ++i) {
-            sim += q[i] * db[idx][i];
-        }
-        if (sim > maxSim) {
-            maxSim = sim;
-            maxIndex = idx;
-        }
-    }
-    cout << "  - Max similarity found at index " << maxIndex << endl;
-    return maxSim;
+ReductionPlanInput ThresholdBiometricSystem::planInput() const {
+    ReductionPlanInput input;
+    input.numVectors = m_config.numVectors;
+    input.vecDim = m_config.vecDim;
+    input.batchSize = m_config.batchSize;
+    input.packGallery = m_config.packGallery;
+    input.targetError = m_config.targetError;
+    input.mergeDepth = [variant = m_config.comparison](const SignApproximation& sign) {
+        return ComparisonKernel::levels(sign, variant);
+    };
+    return input;
 }
@@ -2,60 +2,311 @@
 #define THRESHOLD_BIOMETRIC_SYSTEM_H
 
 #include "openfhe.h"
+#include "ComparisonKernel.h"
+#include "DotProductEngine.h"
+#include "ReductionPlanner.h"
+#include "TemplateMatrix.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+class GalleryCache;
+class GalleryReader;
+class GalleryWriter;
+class KeyStore;
+class TemplateSource;
+struct GalleryHeader;
+
+// What run() decrypts to decide uniqueness.
+enum class DecisionEngine {
+    Max,       // approximate maximum similarity from a polyMax tournament
+    AnyMatch,  // soft count of similarities above the threshold; depth independent of gallery size
+};
+
 struct AppConfig {
-    uint32_t multDepth;
-    size_t numVectors;
-    size_t vecDim;
-    size_t batchSize;
-    double threshold;
-    int numParties;
-    int thresholdT;
+    uint32_t multDepth = 30;
+    uint32_t ringDim = 0;      // 0 = smallest secure ring for the depth (or the planner's)
+    size_t numVectors = 50;
+    size_t vecDim = 512;
+    size_t batchSize = 512;
+    double threshold = 0.85;
+    int numParties = 3;
+    int thresholdT = 2;
+    bool packGallery = true;
+    size_t rotationRadix = 2;  // 2 = baseline rotation keys; 4 hoists at the cost of extra keys
+    size_t readerThreads = 1;
+    size_t workerThreads = 1;
+    size_t queueDepth = 16;
+    size_t numQueries = 1;     // probes answered together in one gallery pass by run()
+    DecisionEngine decision = DecisionEngine::Max;
+    size_t signIterations = 3; // composite sign polynomial iterations for DecisionEngine::AnyMatch
+    SignApproximation maxSign; // sign approximation inside polyMax
+    ComparisonVariant comparison = ComparisonVariant::Lazy;
+    bool autoParams = false;   // let the reduction planner pick maxSign, multDepth and the ring dimension
+    double targetError = 0.1;  // planner's worst-case error per polyMax comparison
+    std::string keystoreDir;   // empty = generate fresh keys every run
+    bool initKeys = false;     // generate into keystoreDir instead of loading from it
+    std::string galleryPath = "encrypted_db.bin";
+    bool keepGallery = false;  // keep the demo gallery instead of deleting it after the run
+    uint32_t galleryDropLevels = 0;  // levels dropped from gallery ciphertexts before they are stored
+    bool galleryAutoLevel = false;   // instead drop every level the query circuit can spare
+    size_t galleryCapacity = 0;      // templates the auto level must serve; 0 = the gallery being written
+    bool compressGallery = false;    // zstd-compress stored records (builds with BIOMETRIC_WITH_ZSTD)
+    bool bootstrap = false;          // refresh the running maximum by bootstrapping; plans depth, ring and batch size
+    uint32_t bootstrapLevelBudget = 3;  // levels for each of the CoeffsToSlots and SlotsToCoeffs transforms
+};
+
+struct EnrollmentStats {
+    size_t templates = 0;
+    size_t records = 0;
+    uint64_t bytesWritten = 0;
+    double seconds = 0.0;
+};
+
+struct CompactionStats {
+    size_t recordsBefore = 0;
+    size_t recordsAfter = 0;
+    size_t recordsRewritten = 0;   // partly filled, live blocks moved into merged records homomorphically
+    size_t templatesRemoved = 0;
+};
+
+// How templates are laid out in the CKKS slots of a gallery ciphertext.
+// With packing, each ciphertext holds templatesPerCiphertext templates in
+// consecutive blocks of blockStride slots; the query is replicated into
+// every block so one EvalMult scores the whole ciphertext.
+struct GalleryLayout {
+    size_t slotCount;
+    size_t blockStride;
+    size_t maxTemplatesPerCiphertext;   // blocks covered by the query, mask and rotation keys
+    size_t templatesPerCiphertext;      // blocks filled when encrypting a gallery of numVectors
+    size_t numCiphertexts;
 };
 
 class ThresholdBiometricSystem {
 public:
     explicit ThresholdBiometricSystem(AppConfig config);
+    ~ThresholdBiometricSystem();
     void run();
 
-private:
-    void setupCKKS();
+    const AppConfig& config() const { return m_config; }
+    const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cryptoContext() const { return m_cryptoContext; }
+
+    // opens a gallery and checks it against the current context and slot layout
+    std::unique_ptr<GalleryReader> openGallery(const std::string& path) const;
+
+    // deserialized records consulted before the file mapping; nullptr disables
+    void setGalleryCache(const GalleryCache* cache) { m_galleryCache = cache; }
 
-    void generateThresholdKeys();
-    
-    std::vector<std::vector<double>> generateTestVectors(size_t numVectors, size_t dimension);
-    
-    std::string encryptVectorDatabaseToFile(const std::vector<std::vector<double>>& vectors);
-    
     lbcrypto::Ciphertext<lbcrypto::DCRTPoly> encryptQueryVector(const std::vector<double>& q);
-    
+
+    // encrypted maximum similarity over the whole gallery, folded into slot 0
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeStreamingApproximation(
+        const GalleryReader& gallery,
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encQuery);
+
+    // one gallery pass for several probes: every record is loaded once and scored
+    // against all queries before it is dropped; returns one maximum per query
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeStreamingApproximations(
+        const GalleryReader& gallery,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries);
+
+    // encrypts every template of source into galleryPath on workerThreads threads, writing
+    // records in source order; with append, records go after those of an existing gallery,
+    // which are not re-encrypted. Template ids must be unique among undeleted templates.
+    EnrollmentStats enrollTemplates(TemplateSource& source, const std::string& galleryPath, bool append);
+
+    // marks templates deleted; the any-match count ignores them at once, the maximum after compaction
+    size_t deleteTemplates(const std::string& galleryPath, const std::vector<uint64_t>& ids);
+
+    // rewrites the gallery without deleted templates: records with no live template are
+    // dropped, the live blocks of partly filled records (deleted or padding blocks) are
+    // merged into as few records as possible (one extra level), and full records are
+    // copied byte for byte
+    CompactionStats compactGallery(const std::string& galleryPath);
+
+    // packed maximum over gallery records [first, last), not yet folded across
+    // blocks: what a shard worker returns to the aggregator
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeShardMax(
+        const GalleryReader& gallery, size_t first, size_t last,
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encQuery);
+
+    // tournament over per-shard maxima in record order, folded into slot 0
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> combineShardMaxima(
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& partials, size_t templatesPerRecord);
+
+    // encrypted number of templates scoring above the threshold, per query, in slot 0;
+    // any value >= 0.5 means at least one match
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeAnyMatchCounts(
+        const GalleryReader& gallery,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries);
+
+    // levels consumed by computeAnyMatchCounts
+    uint32_t anyMatchDepth() const;
+
+    double thresholdDecryptResult(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encryptedResult);
+
+    // Stages of a query on their own, for biometric_bench.
+
+    const GalleryLayout& layout() const { return m_layout; }
+    const ComparisonKernel& comparisonKernel() const { return *m_comparison; }
+
+    TemplateMatrix<double> generateTestVectors(size_t numVectors, size_t dimension);
+
+    std::string encryptVectorDatabaseToFile(const TemplateMatrix<double>& vectors);
+
+    // evaluation keys from a key store are loaded on the first homomorphic evaluation
+    void ensureEvalKeys();
+
     lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeCosineSimilarity(
         const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& query,
         const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& dbvec);
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> polyMax(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a, const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b);
+
+    // polyMax once an operand is close to the depth budget: after refreshing it when
+    // bootstrapping, otherwise by falling back to pureAverage
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> tournamentMerge(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b);
+
+    // levels the query circuit needs on top of a stored record (similarity and reduction),
+    // for numVectors templates or a gallery of the given number of blocks
+    uint32_t queryCircuitDepth() const;
+    uint32_t queryCircuitDepth(size_t templates) const;
+
+    // storage mode of galleries written from now on, validated like --gallery-drop-levels
+    void setGalleryStorage(uint32_t dropLevels, bool compress);
+
+    // counts of the last query
+    size_t averagedMerges() const { return m_averagedMerges; }
+    size_t bootstraps() const { return m_bootstraps; }
+
+private:
+    using Merge = std::function<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>&, const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>&)>;
+
+    // how the streaming paths turn records into per-query scores and combine them
+    struct StreamReduction {
+        std::function<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>(
+            const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& query,
+            const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& record, size_t index)> score;
+        Merge pairMerge;   // tournament nodes inside a batch
+        Merge chainMerge;  // batch results, in batch order
+    };
+
+    void setupCKKS();
+
+    void enableFeatures();
+
+    // depth, ring and batch size of the bootstrapping mode, from the config and comparison kernel
+    BootstrapPlan bootstrapPlan() const;
+
+    // precomputes the bootstrapping transforms; they are not part of the serialized context
+    void setupBootstrapping();
+
+    // bootstraps ct when it has no room left for another merge (bootstrapping mode only)
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> refreshForMerge(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct);
+
+    void saveKeyStore();
+
+    void loadKeyStore();
+
+    void computeGalleryLayout();
+
+    // resolves galleryDropLevels / galleryAutoLevel against the circuit for a gallery
+    // of this many blocks (galleryCapacity, if larger)
+    uint32_t storageDropLevels(size_t templates) const;
+
+    // throws unless records droppedLevels below a fresh encryption leave the query
+    // circuit of a gallery with this many blocks enough depth
+    void requireStoredLevels(uint32_t droppedLevels, size_t templates, const std::string& gallery) const;
+
+    // gallery ciphertext as written to disk: dropLevels towers fewer
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> reduceForStorage(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct,
+                                                              uint32_t dropLevels) const;
+
+    void generateThresholdKeys();
+
+    // reader -> encryption workers -> in-order writer
+    EnrollmentStats encryptTemplates(TemplateSource& source, GalleryWriter& writer);
+
+    // rotates left by whole blocks using the power-of-two block rotation keys
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> rotateBlocks(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct, size_t blocks);
+
+    // block `from` of sources[source] lands on block `to` of a merged record
+    struct BlockMove {
+        size_t source;
+        size_t from;
+        size_t to;
+    };
+
+    // record holding the moved blocks and zeros elsewhere: one rotation and mask per
+    // source and distance, so one level whatever the number of sources
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> packBlocks(
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& sources, const std::vector<BlockMove>& moves);
     
-    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeStreamingApproximation(
-        const std::string& dbFilePath,
-        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encQuery);
+    void validateGalleryLayout(const GalleryHeader& header) const;
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> loadGalleryRecord(const GalleryReader& gallery, size_t index) const;
 
-    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> computeBatchApproximation(
-        std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& sims);
+    // slot-wise maximum per query over records [first, last), before the cross-block fold
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeGalleryMax(
+        const GalleryReader& gallery, size_t first, size_t last,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries);
+
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeGalleryReduction(
+        const GalleryReader& gallery, size_t first, size_t last,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries,
+        const StreamReduction& reduction);
+
+    // single-threaded reference path; the pipelined path must match it bit for bit
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeStreamingSerial(
+        const GalleryReader& gallery, size_t first, size_t last,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries,
+        const StreamReduction& reduction);
+
+    // reader threads feeding a pool of similarity workers through a bounded queue
+    std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> computeStreamingPipelined(
+        const GalleryReader& gallery, size_t first, size_t last,
+        const std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>& encQueries,
+        const StreamReduction& reduction);
+
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> reduceAcrossBlocks(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& packedMax, size_t templatesPerRecord);
+
+    // adds the block-start slots of the first templatesPerRecord blocks into slot 0
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> sumAcrossBlocks(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& packed, size_t templatesPerRecord);
+
+    // ~1 where sim > threshold and ~0 elsewhere, restricted to the slots set in halfMask (0.5 each)
+    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> stepAboveThreshold(
+        const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& sim, const lbcrypto::Plaintext& halfMask);
+
+    // 0.5 at the block-start slot of each live block
+    lbcrypto::Plaintext makeHalfBlockMask(const std::vector<bool>& live);
 
     lbcrypto::Ciphertext<lbcrypto::DCRTPoly> pureAverage(
         const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
         const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b);
 
-    double thresholdDecryptResult(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encryptedResult);
     bool computeThresholdDecision(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& encryptedResult);
 
-    double computePlaintextMaxSimilarity(const std::vector<double>& q, const std::vector<std::vector<double>>& db);
-    
-    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> homomorphicSign(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x);
-    lbcrypto::Ciphertext<lbcrypto::DCRTPoly> polyMax(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a, const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b);
+    ReductionPlanInput planInput() const;
 
     AppConfig m_config;
+    GalleryLayout m_layout;
     lbcrypto::CryptoContext<lbcrypto::DCRTPoly> m_cryptoContext;
+    lbcrypto::Plaintext m_blockMask;
+    std::unique_ptr<DotProductEngine> m_dotEngine;
+    std::unique_ptr<KeyStore> m_keyStore;
+    std::once_flag m_evalKeysOnce;
+    const GalleryCache* m_galleryCache = nullptr;
+    std::unique_ptr<ComparisonKernel> m_comparison;
+    std::atomic<size_t> m_averagedMerges = 0;        // tournament merges that ran out of depth
+    std::atomic<size_t> m_bootstraps = 0;            // ciphertexts refreshed by refreshForMerge
     lbcrypto::PublicKey<lbcrypto::DCRTPoly> m_publicKey;
     
     // in a real system, secret key shares would be distributed.
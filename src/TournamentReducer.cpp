@@ -0,0 +1,151 @@
+#include "TournamentReducer.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+// number of nodes in round `round` of a tournament over n leaves
+size_t nodesInRound(size_t n, size_t round) {
+    for (size_t r = 0; r < round; ++r) n = (n + 1) / 2;
+    return n;
+}
+
+} // namespace
+
+TournamentReducer::TournamentReducer(size_t batchSize, Merge pairMerge, Merge chainMerge)
+    : m_batchSize(batchSize), m_pairMerge(move(pairMerge)), m_chainMerge(move(chainMerge)) {
+    if (m_batchSize == 0) throw invalid_argument("Batch size must be positive");
+}
+
+void TournamentReducer::submit(size_t seq, Ct sim) {
+    unique_lock lock(m_mutex);
+    size_t batch = seq / m_batchSize;
+    // a position in a later batch proves every earlier batch is full
+    for (; m_knownFullBatches < batch; ++m_knownFullBatches) {
+        setBatchSize(m_knownFullBatches, m_batchSize);
+    }
+    place(batch, 0, seq % m_batchSize, move(sim));
+    drain(lock);
+}
+
+void TournamentReducer::finish(size_t total) {
+    unique_lock lock(m_mutex);
+    m_totalBatches = (total + m_batchSize - 1) / m_batchSize;
+    for (size_t b = m_knownFullBatches; b < m_totalBatches; ++b) {
+        setBatchSize(b, min(m_batchSize, total - b * m_batchSize));
+    }
+    m_knownFullBatches = max(m_knownFullBatches, m_totalBatches);
+    m_finished = true;
+    drain(lock);
+}
+
+TournamentReducer::Ct TournamentReducer::result() {
+    unique_lock lock(m_mutex);
+    drain(lock);
+    m_done.wait(lock, [&] { return m_error || (m_finished && m_nextBatch == m_totalBatches); });
+    if (m_error) rethrow_exception(m_error);
+    if (m_totalBatches == 0) throw runtime_error("Cannot process an empty batch.");
+    return m_global;
+}
+
+size_t TournamentReducer::batchCount() const {
+    lock_guard lock(m_mutex);
+    return m_totalBatches;
+}
+
+void TournamentReducer::place(size_t batch, size_t round, size_t index, Ct ct) {
+    Batch& st = m_batches[batch];
+    if (st.size != 0) {
+        size_t n = nodesInRound(st.size, round);
+        if (n == 1) {
+            completeBatch(batch, move(ct));
+            return;
+        }
+        if ((n & 1) && index == n - 1) {
+            // odd node out is carried to the next round unchanged
+            place(batch, round + 1, index / 2, move(ct));
+            return;
+        }
+    }
+
+    auto sibling = st.nodes.find({round, index ^ 1});
+    if (sibling == st.nodes.end()) {
+        st.nodes.emplace(make_pair(round, index), move(ct));
+        return;
+    }
+    Ct other = move(sibling->second);
+    st.nodes.erase(sibling);
+    bool isLeft = (index & 1) == 0;
+    m_work.push_back({false, batch, round + 1, index / 2,
+                      isLeft ? move(ct) : move(other), isLeft ? move(other) : move(ct)});
+}
+
+void TournamentReducer::setBatchSize(size_t batch, size_t size) {
+    Batch& st = m_batches[batch];
+    if (st.size != 0) return;
+    st.size = size;
+    // nodes parked before the size was known may now be carries or the root
+    auto parked = move(st.nodes);
+    st.nodes.clear();
+    for (auto& [key, ct] : parked) {
+        place(batch, key.first, key.second, move(ct));
+    }
+}
+
+void TournamentReducer::completeBatch(size_t batch, Ct batchMax) {
+    m_batches.erase(batch);
+    m_batchMaxima.emplace(batch, move(batchMax));
+    scheduleGlobal();
+}
+
+void TournamentReducer::scheduleGlobal() {
+    while (!m_globalBusy) {
+        auto it = m_batchMaxima.find(m_nextBatch);
+        if (it == m_batchMaxima.end()) return;
+        Ct batchMax = move(it->second);
+        m_batchMaxima.erase(it);
+        if (m_nextBatch == 0) {
+            m_global = move(batchMax);
+            ++m_nextBatch;
+            continue;
+        }
+        m_work.push_back({true, m_nextBatch, 0, 0, m_global, move(batchMax)});
+        m_globalBusy = true;
+    }
+}
+
+void TournamentReducer::drain(unique_lock<mutex>& lock) {
+    while (!m_work.empty() && !m_error) {
+        Work work = move(m_work.front());
+        m_work.pop_front();
+
+        lock.unlock();
+        Ct merged;
+        exception_ptr error;
+        try {
+            merged = work.global ? m_chainMerge(work.left, work.right) : m_pairMerge(work.left, work.right);
+        } catch (...) {
+            error = current_exception();
+        }
+        work.left.reset();
+        work.right.reset();
+        lock.lock();
+
+        if (error) {
+            m_error = error;
+            break;
+        }
+        if (work.global) {
+            m_global = move(merged);
+            ++m_nextBatch;
+            m_globalBusy = false;
+            scheduleGlobal();
+        } else {
+            place(work.batch, work.round, work.index, move(merged));
+        }
+    }
+    m_done.notify_all();
+}
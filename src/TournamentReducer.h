@@ -0,0 +1,82 @@
+#ifndef TOURNAMENT_REDUCER_H
+#define TOURNAMENT_REDUCER_H
+
+#include "openfhe.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+
+// Concurrent version of the streaming max reduction.
+//
+// Similarities are submitted with their stream position from any thread, in any
+// order. Each batch of batchSize positions is reduced with the same pairing as
+// the serial OnlineTournament (node j of a round merges nodes 2j and 2j+1 of the
+// previous round, an odd last node is carried up), and batch maxima are folded
+// left to right into the global maximum. A pair is merged as soon as both halves
+// exist, on whichever thread completed it, so the result is bit-for-bit the same
+// for any thread count or arrival order.
+class TournamentReducer {
+public:
+    using Ct = lbcrypto::Ciphertext<lbcrypto::DCRTPoly>;
+    using Merge = std::function<Ct(const Ct&, const Ct&)>;
+
+    // pairMerge combines tournament nodes inside a batch, chainMerge folds batch maxima
+    TournamentReducer(size_t batchSize, Merge pairMerge, Merge chainMerge);
+
+    // may run merges on the calling thread before returning
+    void submit(size_t seq, Ct sim);
+
+    // called once the total number of submissions is known
+    void finish(size_t total);
+
+    // blocks until every merge has run; rethrows the first merge failure
+    Ct result();
+
+    size_t batchCount() const;
+
+private:
+    struct Batch {
+        size_t size = 0;     // 0 until known
+        std::map<std::pair<size_t, size_t>, Ct> nodes;  // (round, index) waiting for a sibling
+    };
+
+    struct Work {
+        bool global;
+        size_t batch;
+        size_t round;
+        size_t index;
+        Ct left;
+        Ct right;
+    };
+
+    void place(size_t batch, size_t round, size_t index, Ct ct);
+    void setBatchSize(size_t batch, size_t size);
+    void completeBatch(size_t batch, Ct batchMax);
+    void scheduleGlobal();
+    void drain(std::unique_lock<std::mutex>& lock);
+
+    const size_t m_batchSize;
+    Merge m_pairMerge;
+    Merge m_chainMerge;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_done;
+    std::map<size_t, Batch> m_batches;
+    std::map<size_t, Ct> m_batchMaxima;
+    std::deque<Work> m_work;
+    size_t m_knownFullBatches = 0;
+    size_t m_totalBatches = 0;
+    bool m_finished = false;
+
+    Ct m_global;
+    size_t m_nextBatch = 0;
+    bool m_globalBusy = false;
+    std::exception_ptr m_error;
+};
+
+#endif // TOURNAMENT_REDUCER_H
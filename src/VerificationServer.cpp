@@ -0,0 +1,185 @@
+#include "VerificationServer.h"
+#include "LatencyStats.h"
+#include "ShardAggregator.h"
+#include "ThresholdBiometricSystem.h"
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+#include <syncstream>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace lbcrypto;
+using namespace std;
+
+namespace {
+
+atomic<bool> g_stopRequested = false;
+
+extern "C" void requestStop(int) {
+    g_stopRequested = true;
+}
+
+// waits until fd is readable; false once a stop was requested
+bool waitReadable(int fd) {
+    while (!g_stopRequested) {
+        pollfd pfd{fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, 250);
+        if (rc > 0) return true;
+        if (rc < 0 && errno != EINTR) throw runtime_error("poll() failed");
+    }
+    return false;
+}
+
+// true once the peer closed its end; a peer that sent more data is still there
+bool peerClosed(int fd) {
+    pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) return false;
+    if (pfd.revents & (POLLHUP | POLLERR)) return true;
+    char byte;
+    return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+} // namespace
+
+VerificationServer::VerificationServer(ThresholdBiometricSystem& system, const string& galleryPath, uint64_t cacheBudgetBytes,
+                                       size_t cacheFirst)
+    : m_system(system), m_maxPayload(maxMessagePayload(system.cryptoContext())) {
+    cout << "\nOpening gallery " << galleryPath << "..." << endl;
+    m_gallery = m_system.openGallery(galleryPath);
+    cout << "* " << m_gallery->recordCount() << " records, " << m_gallery->header().numTemplates << " templates, "
+         << m_gallery->fileSize() / (1024 * 1024) << " MiB" << endl;
+
+    auto start = chrono::steady_clock::now();
+    m_cache = make_unique<GalleryCache>(*m_gallery, cacheBudgetBytes, cacheFirst);
+    auto end = chrono::steady_clock::now();
+    cout << "* Cached " << m_cache->residentRecords() << "/" << m_gallery->recordCount() << " records from " << cacheFirst << " ("
+         << m_cache->residentBytes() / (1024 * 1024) << " MiB, took "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count() << "ms)" << endl;
+    m_system.setGalleryCache(m_cache.get());
+}
+
+VerificationServer::VerificationServer(ThresholdBiometricSystem& system, ShardAggregator& aggregator)
+    : m_system(system), m_aggregator(&aggregator), m_maxPayload(maxMessagePayload(system.cryptoContext())) {}
+
+void VerificationServer::serve(const string& socketPath) {
+    struct sigaction sa{};
+    sa.sa_handler = requestStop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    UniqueFd listener = listenUnix(socketPath);
+    cout << "\nServing on " << socketPath << " (Ctrl-C to stop)" << endl;
+
+    // one thread per connection; finished ones are joined on the next accept
+    struct Connection {
+        shared_ptr<atomic<bool>> finished;
+        jthread thread;
+    };
+    vector<Connection> connections;
+    size_t nextId = 1;
+    while (waitReadable(listener.get())) {
+        UniqueFd conn(::accept(listener.get(), nullptr, nullptr));
+        if (!conn) continue;
+        erase_if(connections, [](const Connection& c) { return c.finished->load(); });
+        size_t id = nextId++;
+        auto finished = make_shared<atomic<bool>>(false);
+        jthread thread([this, id, finished](UniqueFd fd) {
+            handleConnection(move(fd), id);
+            *finished = true;
+        }, move(conn));
+        connections.push_back({move(finished), move(thread)});
+    }
+
+    cout << "\nShutting down..." << endl;
+    connections.clear();
+    ::unlink(socketPath.c_str());
+    printSummary();
+}
+
+void VerificationServer::handleConnection(UniqueFd conn, size_t connectionId) {
+    osyncstream(cout) << "  - Client " << connectionId << " connected" << endl;
+    try {
+        Message message;
+        while (waitReadable(conn.get()) && receiveMessage(conn.get(), message, m_maxPayload)) {
+            if (message.type != MessageType::Query && message.type != MessageType::ShardQuery) {
+                string error = "Unexpected message type " + to_string((uint32_t)message.type);
+                sendMessage(conn.get(), MessageType::Error, error);
+                continue;
+            }
+            try {
+                optional<string> result = message.type == MessageType::Query ? answer(message)
+                                                                             : answerShard(message, conn.get());
+                if (!result) break;
+                sendMessage(conn.get(), MessageType::Result, *result);
+            } catch (const exception& e) {
+                sendMessage(conn.get(), MessageType::Error, string(e.what()));
+            }
+        }
+    } catch (const exception& e) {
+        osyncstream(cerr) << "  - Client " << connectionId << ": " << e.what() << endl;
+    }
+    osyncstream(cout) << "  - Client " << connectionId << " disconnected" << endl;
+}
+
+string VerificationServer::answer(const Message& query) {
+    lock_guard lock(m_evalMutex);
+    auto start = chrono::steady_clock::now();
+
+    auto encQuery = deserializeCiphertext(query.payload);
+    auto encMax = m_aggregator ? m_aggregator->computeMax(encQuery)
+                               : m_system.computeStreamingApproximation(*m_gallery, encQuery);
+    string result = serializeCiphertext(encMax);
+
+    auto end = chrono::steady_clock::now();
+    recordLatency(chrono::duration<double, milli>(end - start).count());
+    return result;
+}
+
+optional<string> VerificationServer::answerShard(const Message& query, int fd) {
+    if (!m_gallery) throw runtime_error("This server aggregates and holds no gallery records");
+    lock_guard lock(m_evalMutex);
+    // the aggregator hangs up on a piece another worker answered first; a piece
+    // already being evaluated runs to the end, one still queued here is skipped
+    if (peerClosed(fd)) return nullopt;
+    auto start = chrono::steady_clock::now();
+
+    span<const char> queryBytes;
+    ShardRange range = decodeShardQuery(query.payload, queryBytes);
+    auto partial = m_system.computeShardMax(*m_gallery, range.first, range.last, deserializeCiphertext(queryBytes));
+    string result = serializeCiphertext(partial);
+
+    auto end = chrono::steady_clock::now();
+    recordLatency(chrono::duration<double, milli>(end - start).count());
+    return result;
+}
+
+void VerificationServer::recordLatency(double ms) {
+    lock_guard lock(m_statsMutex);
+    auto now = chrono::steady_clock::now();
+    if (m_latenciesMs.empty()) m_firstQuery = now - chrono::duration_cast<chrono::steady_clock::duration>(
+                                                        chrono::duration<double, milli>(ms));
+    m_lastQuery = now;
+    m_latenciesMs.push_back(ms);
+
+    double elapsed = chrono::duration<double>(m_lastQuery - m_firstQuery).count();
+    osyncstream(cout) << "  - Query " << m_latenciesMs.size() << ": " << fixed << setprecision(1) << ms
+                      << "ms (" << setprecision(3) << m_latenciesMs.size() / elapsed << " queries/s overall)" << endl;
+}
+
+void VerificationServer::printSummary() const {
+    lock_guard lock(m_statsMutex);
+    if (m_latenciesMs.empty()) {
+        cout << "* No queries served" << endl;
+        return;
+    }
+    double elapsed = chrono::duration<double>(m_lastQuery - m_firstQuery).count();
+    cout << "* Served " << m_latenciesMs.size() << " queries: " << summarizeLatencies(m_latenciesMs) << endl;
+    cout << "* Throughput: " << fixed << setprecision(3) << m_latenciesMs.size() / elapsed << " queries/s" << endl;
+}
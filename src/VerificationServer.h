@@ -0,0 +1,58 @@
+#ifndef VERIFICATION_SERVER_H
+#define VERIFICATION_SERVER_H
+
+#include "GalleryCache.h"
+#include "GalleryFile.h"
+#include "Protocol.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+class ShardAggregator;
+class ThresholdBiometricSystem;
+
+// Resident verification service: keys, the gallery mapping and a budgeted
+// set of deserialized records stay loaded, and each encrypted query received
+// on the Unix socket is answered with its encrypted maximum similarity.
+// Queries are evaluated one at a time; each one already uses the full
+// reader/worker pipeline. The same server answers an aggregator's shard
+// queries, and in front of a ShardAggregator it serves clients unchanged.
+class VerificationServer {
+public:
+    // the cache pins records from cacheFirst on (a shard worker's home shard)
+    VerificationServer(ThresholdBiometricSystem& system, const std::string& galleryPath, uint64_t cacheBudgetBytes,
+                       size_t cacheFirst = 0);
+
+    // answers client queries by scatter/gather over shard workers
+    VerificationServer(ThresholdBiometricSystem& system, ShardAggregator& aggregator);
+
+    // runs until SIGINT or SIGTERM
+    void serve(const std::string& socketPath);
+
+private:
+    void handleConnection(UniqueFd conn, size_t connectionId);
+    std::string answer(const Message& query);
+    // nullopt when the aggregator hung up while the piece waited for m_evalMutex
+    std::optional<std::string> answerShard(const Message& query, int fd);
+    void recordLatency(double ms);
+    void printSummary() const;
+
+    ThresholdBiometricSystem& m_system;
+    std::unique_ptr<GalleryReader> m_gallery;
+    std::unique_ptr<GalleryCache> m_cache;
+    ShardAggregator* m_aggregator = nullptr;
+    const uint64_t m_maxPayload;
+
+    std::mutex m_evalMutex;
+    mutable std::mutex m_statsMutex;
+    std::vector<double> m_latenciesMs;
+    std::chrono::steady_clock::time_point m_firstQuery;
+    std::chrono::steady_clock::time_point m_lastQuery;
+};
+
+#endif // VERIFICATION_SERVER_H
@@ -0,0 +1,102 @@
+#include "LatencyStats.h"
+#include "Protocol.h"
+#include "ThresholdBiometricSystem.h"
+#include "argparse.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+// Submits N encrypted random queries to a running `biometric_verify --serve`
+// and reports per-query latency and throughput. Uses the same key store as the
+// server; evaluation keys are never loaded on this side.
+int main(int argc, char** argv) {
+    argparse::ArgumentParser program("biometric_client");
+
+    program.add_argument("--socket")
+        .help("Unix socket of the verification server")
+        .required();
+
+    program.add_argument("--keystore")
+        .help("Key store shared with the server")
+        .required();
+
+    program.add_argument("--num-queries")
+        .help("Number of queries to submit")
+        .default_value(10ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--threshold")
+        .help("Match threshold for the reported decision")
+        .default_value(0.85)
+        .scan<'g', double>();
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    AppConfig config;
+    config.keystoreDir = program.get<std::string>("--keystore");
+    config.threshold = program.get<double>("--threshold");
+    const size_t numQueries = program.get<size_t>("--num-queries");
+
+    try {
+        ThresholdBiometricSystem client(config);
+        UniqueFd conn = connectUnix(program.get<std::string>("--socket"));
+        const uint64_t maxPayload = maxMessagePayload(client.cryptoContext());
+
+        std::mt19937 gen(7);
+        std::normal_distribution<double> dist(0.0, 1.0);
+        std::vector<double> latenciesMs;
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < numQueries; ++i) {
+            std::vector<double> q(client.config().vecDim);
+            double norm = 0.0;
+            for (auto& x : q) {
+                x = dist(gen);
+                norm += x * x;
+            }
+            for (auto& x : q) x /= std::sqrt(norm);
+
+            auto encQuery = client.encryptQueryVector(q);
+            std::string payload = serializeCiphertext(encQuery);
+
+            auto sent = std::chrono::steady_clock::now();
+            sendMessage(conn.get(), MessageType::Query, payload);
+            Message reply;
+            if (!receiveMessage(conn.get(), reply, maxPayload)) throw std::runtime_error("Server closed the connection");
+            auto received = std::chrono::steady_clock::now();
+
+            if (reply.type == MessageType::Error) {
+                throw std::runtime_error("Server error: " + std::string(reply.payload.begin(), reply.payload.end()));
+            }
+            double ms = std::chrono::duration<double, std::milli>(received - sent).count();
+            latenciesMs.push_back(ms);
+
+            double score = client.thresholdDecryptResult(deserializeCiphertext(reply.payload));
+            std::cout << "Query " << (i + 1) << ": " << std::fixed << std::setprecision(1) << ms << "ms, max similarity "
+                      << std::setprecision(6) << score << " -> " << (score < config.threshold ? "UNIQUE" : "NOT UNIQUE")
+                      << std::endl;
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "\n" << std::string(60, '=') << std::endl;
+        std::cout << "Queries:     " << numQueries << std::endl;
+        std::cout << "Latency:     " << summarizeLatencies(latenciesMs) << std::endl;
+        std::cout << "Throughput:  " << std::fixed << std::setprecision(3) << numQueries / elapsed << " queries/s" << std::endl;
+        std::cout << std::string(60, '=') << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "\nFATAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,8 +1,17 @@
+#include "Metrics.h"
+#include "ShardAggregator.h"
+#include "TemplateSource.h"
 #include "ThresholdBiometricSystem.h"
+#include "VerificationServer.h"
 #include "argparse.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
+#include <thread>
 
 int main(int argc, char** argv) {
     argparse::ArgumentParser program("biometric_verify");
@@ -12,6 +21,11 @@ int main(int argc, char** argv) {
         .default_value(30u)
         .scan<'u', uint32_t>();
 
+    program.add_argument("--ring-dim")
+        .help("Ring dimension (0 = smallest secure ring for the depth)")
+        .default_value(0u)
+        .scan<'u', uint32_t>();
+
     program.add_argument("--num-vectors")
         .help("Number of vectors in the database")
         .default_value(50ul)
@@ -27,6 +41,141 @@ int main(int argc, char** argv) {
         .default_value(512ul)
         .scan<'u', size_t>();
 
+    program.add_argument("--packing")
+        .help("Gallery layout: 'packed' fills every slot of a ciphertext with templates, 'single' stores one per ciphertext")
+        .default_value(std::string("packed"))
+        .choices("packed", "single");
+
+    program.add_argument("--decision")
+        .help("Decision engine: 'max' decrypts an approximate maximum, 'any-match' a soft count of scores above the threshold")
+        .default_value(std::string("max"))
+        .choices("max", "any-match");
+
+    program.add_argument("--sign-iterations")
+        .help("Composite sign polynomial iterations used by --decision any-match (3 levels each)")
+        .default_value(3ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--bootstrap")
+        .help("Refresh the running maximum by bootstrapping between batches; plans depth, ring and batch size itself")
+        .flag();
+
+    program.add_argument("--bootstrap-level-budget")
+        .help("Levels for each of the two bootstrapping transforms (more levels, fewer rotations)")
+        .default_value(3u)
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--auto-params")
+        .help("Plan the sign approximation, multiplicative depth and ring dimension from the workload")
+        .flag();
+
+    program.add_argument("--target-error")
+        .help("Worst-case error per polyMax comparison the planner aims for with --auto-params")
+        .default_value(0.1)
+        .scan<'g', double>();
+
+    program.add_argument("--comparison")
+        .help("polyMax kernel: 'lazy' (deferred relinearization), 'fused', 'chebyshev' (one series) or 'reference' (original)")
+        .default_value(std::string("lazy"))
+        .choices("lazy", "fused", "chebyshev", "reference");
+
+    program.add_argument("--rotation-radix")
+        .help("Rotations per hoisted stage of the dot-product slot sum (2 = serial rotate-and-add chain with the "
+              "baseline rotation keys; 4 needs more keys)")
+        .default_value(2ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--reader-threads")
+        .help("Threads reading and deserializing gallery records")
+        .default_value(1ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--worker-threads")
+        .help("Similarity worker threads (0 = all hardware threads, 1 = serial reference path)")
+        .default_value(1ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--queue-depth")
+        .help("Deserialized ciphertexts buffered between the reader and the workers")
+        .default_value(16ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--num-queries")
+        .help("Queries answered together in one pass over the gallery")
+        .default_value(1ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--keystore")
+        .help("Directory to load the crypto context and keys from (or write them to with --init-keys)")
+        .default_value(std::string(""));
+
+    program.add_argument("--init-keys")
+        .help("Generate a fresh context and keys into --keystore and exit")
+        .flag();
+
+    program.add_argument("--gallery")
+        .help("Encrypted gallery file")
+        .default_value(std::string("encrypted_db.bin"));
+
+    program.add_argument("--keep-gallery")
+        .help("Keep the demo's encrypted gallery instead of deleting it")
+        .flag();
+
+    program.add_argument("--gallery-drop-levels")
+        .help("Levels dropped from gallery ciphertexts before they are written, or 'auto' for all the query circuit can spare")
+        .default_value(std::string("0"));
+
+    program.add_argument("--gallery-capacity")
+        .help("Templates the gallery will grow to; --gallery-drop-levels auto keeps the depth a query over that many needs")
+        .default_value(0ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--compress-gallery")
+        .help("zstd-compress gallery records (needs a build with -DBIOMETRIC_WITH_ZSTD=ON)")
+        .flag();
+
+    program.add_argument("--metrics")
+        .help("Count HE operations, stage times and merge levels, and write them here on exit (*.prom = Prometheus text, else JSON)")
+        .default_value(std::string(""));
+
+    program.add_argument("--serve")
+        .help("Serve encrypted queries against --gallery on this Unix socket (requires --keystore)")
+        .default_value(std::string(""));
+
+    program.add_argument("--cache-mib")
+        .help("Memory budget for deserialized gallery records kept resident by --serve")
+        .default_value(4096ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--shard")
+        .help("With --serve: act as shard worker INDEX/COUNT, keeping that part of the gallery resident")
+        .default_value(std::string(""));
+
+    program.add_argument("--workers")
+        .help("With --serve: aggregate over shard workers on these sockets instead of reading the gallery")
+        .nargs(argparse::nargs_pattern::at_least_one);
+
+    program.add_argument("--pieces-per-worker")
+        .help("Pieces each worker's shard is split into for work stealing and straggler backups")
+        .default_value(4ul)
+        .scan<'u', size_t>();
+
+    program.add_argument("--enroll")
+        .help("Encrypt the templates in this file (*.csv = id,v1,...; else uint64 id + float32 values) into --gallery")
+        .default_value(std::string(""));
+
+    program.add_argument("--append")
+        .help("With --enroll: add to the existing --gallery instead of replacing it")
+        .flag();
+
+    program.add_argument("--delete-ids")
+        .help("Mark the template ids listed in this file (one per line) deleted in --gallery")
+        .default_value(std::string(""));
+
+    program.add_argument("--compact")
+        .help("Drop deleted templates from --gallery, re-packing partly deleted records")
+        .flag();
+
     try {
         program.parse_args(argc, argv);
     }
@@ -39,15 +188,117 @@ int main(int argc, char** argv) {
     AppConfig config;
     config.multDepth = program.get<uint32_t>("--mult-depth");
     config.numVectors = program.get<size_t>("--num-vectors");
+    config.ringDim = program.get<uint32_t>("--ring-dim");
     config.vecDim = program.get<size_t>("--vec-dim");
     config.batchSize = program.get<size_t>("--batch-size");
     config.threshold = 0.85;
     config.numParties = 3;
     config.thresholdT = 2;
+    config.packGallery = program.get<std::string>("--packing") == "packed";
+    config.decision = program.get<std::string>("--decision") == "any-match" ? DecisionEngine::AnyMatch : DecisionEngine::Max;
+    config.signIterations = program.get<size_t>("--sign-iterations");
+    config.autoParams = program.get<bool>("--auto-params");
+    config.bootstrap = program.get<bool>("--bootstrap");
+    config.bootstrapLevelBudget = program.get<uint32_t>("--bootstrap-level-budget");
+    config.targetError = program.get<double>("--target-error");
+    config.comparison = ComparisonKernel::parse(program.get<std::string>("--comparison"));
+    config.rotationRadix = program.get<size_t>("--rotation-radix");
+    config.readerThreads = program.get<size_t>("--reader-threads");
+    config.workerThreads = program.get<size_t>("--worker-threads");
+    if (config.workerThreads == 0) {
+        config.workerThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    config.queueDepth = program.get<size_t>("--queue-depth");
+    config.numQueries = program.get<size_t>("--num-queries");
+    config.keystoreDir = program.get<std::string>("--keystore");
+    config.initKeys = program.get<bool>("--init-keys");
+    if (config.initKeys && config.keystoreDir.empty()) {
+        std::cerr << "--init-keys requires --keystore" << std::endl;
+        return 1;
+    }
+    config.galleryPath = program.get<std::string>("--gallery");
+    config.keepGallery = program.get<bool>("--keep-gallery");
+    const std::string dropLevels = program.get<std::string>("--gallery-drop-levels");
+    if (dropLevels == "auto") {
+        config.galleryAutoLevel = true;
+    } else if (std::sscanf(dropLevels.c_str(), "%u", &config.galleryDropLevels) != 1) {
+        std::cerr << "--gallery-drop-levels expects a level count or 'auto', got '" << dropLevels << "'" << std::endl;
+        return 1;
+    }
+    config.galleryCapacity = program.get<size_t>("--gallery-capacity");
+    config.compressGallery = program.get<bool>("--compress-gallery");
+    const std::string serveSocket = program.get<std::string>("--serve");
+    if (!serveSocket.empty() && config.keystoreDir.empty()) {
+        std::cerr << "--serve requires --keystore so clients can encrypt under the same keys" << std::endl;
+        return 1;
+    }
+    const auto workerSockets = program.present<std::vector<std::string>>("--workers");
+    const std::string shard = program.get<std::string>("--shard");
+    size_t shardIndex = 0;
+    size_t shardCount = 1;
+    if (!shard.empty() && (std::sscanf(shard.c_str(), "%zu/%zu", &shardIndex, &shardCount) != 2 ||
+                           shardCount == 0 || shardIndex >= shardCount)) {
+        std::cerr << "--shard expects INDEX/COUNT with INDEX < COUNT, got '" << shard << "'" << std::endl;
+        return 1;
+    }
+    if ((workerSockets || !shard.empty()) && serveSocket.empty()) {
+        std::cerr << "--workers and --shard require --serve" << std::endl;
+        return 1;
+    }
+
+    const std::string enrollPath = program.get<std::string>("--enroll");
+    const std::string deleteIdsPath = program.get<std::string>("--delete-ids");
+    const bool compact = program.get<bool>("--compact");
+    const bool maintain = !enrollPath.empty() || !deleteIdsPath.empty() || compact;
+    if (maintain && config.keystoreDir.empty()) {
+        std::cerr << "--enroll, --delete-ids and --compact require --keystore so the gallery outlives this run" << std::endl;
+        return 1;
+    }
+    if (program.get<bool>("--append") && enrollPath.empty()) {
+        std::cerr << "--append requires --enroll" << std::endl;
+        return 1;
+    }
+    std::vector<uint64_t> deleteIds;
+    if (!deleteIdsPath.empty()) {
+        std::ifstream in(deleteIdsPath);
+        if (!in) {
+            std::cerr << "Cannot open " << deleteIdsPath << std::endl;
+            return 1;
+        }
+        for (uint64_t id; in >> id; ) deleteIds.push_back(id);
+        if (!in.eof()) {
+            std::cerr << deleteIdsPath << " must hold one template id per line" << std::endl;
+            return 1;
+        }
+    }
+
+    const std::string metricsPath = program.get<std::string>("--metrics");
+    Metrics::enable(!metricsPath.empty());
 
     try {
         ThresholdBiometricSystem demo(config);
-        demo.run();
+        if (maintain) {
+            if (!enrollPath.empty()) {
+                TemplateFileSource source(enrollPath, config.vecDim);
+                demo.enrollTemplates(source, config.galleryPath, program.get<bool>("--append"));
+            }
+            if (!deleteIds.empty()) demo.deleteTemplates(config.galleryPath, deleteIds);
+            if (compact) demo.compactGallery(config.galleryPath);
+        } else if (workerSockets) {
+            ShardAggregator aggregator(demo, config.galleryPath, *workerSockets, program.get<size_t>("--pieces-per-worker"));
+            VerificationServer server(demo, aggregator);
+            server.serve(serveSocket);
+        } else if (!serveSocket.empty()) {
+            size_t cacheFirst = shardRange(demo.openGallery(config.galleryPath)->recordCount(), shardIndex, shardCount).first;
+            VerificationServer server(demo, config.galleryPath, program.get<size_t>("--cache-mib") << 20, cacheFirst);
+            server.serve(serveSocket);
+        } else if (!config.initKeys) {
+            demo.run();
+        }
+        if (!metricsPath.empty()) {
+            Metrics::dump(metricsPath);
+            std::cout << "* Metrics written to " << metricsPath << std::endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << "\nFATAL ERROR: " << e.what() << std::endl;
         return 1;